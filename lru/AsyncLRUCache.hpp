@@ -0,0 +1,247 @@
+/* @file AsyncLRUCache.hpp*/
+#ifndef ASYNC_LRU_CACHE_HPP
+#define ASYNC_LRU_CACHE_HPP
+
+// the compiler defines __cpp_impl_coroutine when coroutines are enabled, <coroutine> then
+// defines __cpp_lib_coroutine if the library supports them
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    /**
+     * The AsyncLRUCache class templated by
+     *        Key - key type
+     *        Value - value type
+     *        Lock - a lock type like std::mutex
+     *        Policy - the eviction policy of the underlying LRUCache
+     *
+     * An LRUCache for C++20 coroutines: co_await cache.get(k, loader) completes without
+     * suspending on a hit. On a miss the coroutine suspends while loader(k) runs in a task
+     * passed to the executor, so blocking loads stay off the threads driving the coroutines
+     * (an event loop, a reactor). A single load runs per key and every coroutine missing k
+     * meanwhile suspends on it too. Once the value is loaded and inserted, the waiters are
+     * resumed one after the other on the thread that ran the load, or get the exception of
+     * the loader rethrown by co_await, in which case nothing is cached.
+     * The lock is only held to look the key up and to publish the result, never across a
+     * suspension. The tasks use the cache, so the executor must run or drop them before the
+     * cache is destroyed.
+     * Requires C++20.
+     */
+    template <class Key, class Value, class Lock = std::mutex,
+    template <typename, typename> class Policy = LRUPolicy>
+    class AsyncLRUCache {
+
+    public:
+        typedef Lock lock_type;
+        using Guard = std::lock_guard<lock_type>;
+        using Loader = std::function<Value(const Key&)>;
+        using Executor = std::function<void(std::function<void()>)>;
+        typedef LRUCache<Key, Value, NullLock, LRUMap<Key, Value>, Policy> cache_type;
+        typedef typename cache_type::node_type node_type;
+    private:
+        // Dissallow copying.
+        AsyncLRUCache(const AsyncLRUCache&) = delete;
+        AsyncLRUCache& operator=(const AsyncLRUCache&) = delete;
+
+        /**
+         * a load in flight, shared by the coroutines waiting for it, written under lock_
+         */
+        struct Flight {
+            std::vector<std::coroutine_handle<>> waiters;
+            std::optional<Value> value;
+            std::exception_ptr error;
+            bool done = false;
+        };
+
+        mutable Lock lock_;
+        cache_type cache_;
+        std::unordered_map<Key, std::shared_ptr<Flight>> loading_;
+        Executor executor_;
+
+        void start(Key k, Loader loader, size_t s, std::shared_ptr<Flight> flight) {
+            std::function<void()> task = [this, k, loader, s, flight] () {
+                std::optional<Value> v;
+                std::exception_ptr error;
+                try {
+                    v.emplace(loader(k));
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                std::vector<std::coroutine_handle<>> waiters;
+                {
+                    Guard g(lock_);
+                    if (v) {
+                        try {
+                            cache_.insert(k, *v, s);
+                        }
+                        catch (...) {
+                            // too large to be cached, the waiters still get the value
+                        }
+                    }
+                    flight->value = std::move(v);
+                    flight->error = error;
+                    flight->done = true;
+                    loading_.erase(k);
+                    waiters.swap(flight->waiters);
+                }
+                for (auto h : waiters)
+                    h.resume();
+            };
+            executor_(std::move(task));
+        }
+
+    public:
+        /**
+         * the awaitable returned by get(), to be co_awaited once
+         */
+        class GetAwaitable {
+            friend class AsyncLRUCache;
+            AsyncLRUCache* cache_;
+            Key key_;
+            Loader loader_;
+            size_t size_;
+            std::optional<Value> value_;
+            std::shared_ptr<Flight> flight_;
+            bool leader_;
+
+            GetAwaitable(AsyncLRUCache* cache, const Key& k, Loader loader, size_t s)
+            : cache_(cache), key_(k), loader_(std::move(loader)), size_(s), leader_(false) {}
+        public:
+            bool await_ready() {
+                Guard g(cache_->lock_);
+                if (cache_->cache_.contains(key_)) {
+                    value_.emplace(cache_->cache_.get(key_));
+                    return true;
+                }
+                const auto l = cache_->loading_.find(key_);
+                if (l != cache_->loading_.end()) {
+                    flight_ = l->second;
+                }
+                else {
+                    flight_ = std::make_shared<Flight>();
+                    cache_->loading_.emplace(key_, flight_);
+                    leader_ = true;
+                }
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> h) {
+                AsyncLRUCache* cache = cache_;
+                const bool leader = leader_;
+                {
+                    Guard g(cache->lock_);
+                    // the load may have completed since await_ready()
+                    if (flight_->done)
+                        return false;
+                    flight_->waiters.push_back(h);
+                }
+                // once h is registered the load can resume it and destroy this awaitable at any time,
+                // only the leader may still read its members since nothing resumes h before start()
+                if (leader)
+                    cache->start(key_, std::move(loader_), size_, flight_);
+                return true;
+            }
+
+            Value await_resume() {
+                if (value_)
+                    return std::move(*value_);
+                if (flight_->error)
+                    std::rethrow_exception(flight_->error);
+                return *flight_->value;
+            }
+        };
+
+        /**
+         * executor runs the loads, typically a thread pool, maxSize and elasticity as in LRUCache
+         * Throws std::invalid_argument if executor is empty.
+         */
+        explicit AsyncLRUCache(Executor executor, size_t maxSize = 64, size_t elasticity = 10)
+        : cache_(maxSize, elasticity), executor_(std::move(executor)) {
+            if (!executor_)
+                throw std::invalid_argument("async_lru_cache_requires_an_executor");
+        }
+
+        virtual ~AsyncLRUCache() = default;
+
+        /**
+         * co_await get(k, loader, s) returns the value of k, loading it with loader(k) and
+         * inserting it with size s on a miss
+         */
+        GetAwaitable get(const Key& k, Loader loader, const size_t & s = 1) {
+            return GetAwaitable(this, k, std::move(loader), s);
+        }
+
+        /**
+         * Try to get the value for k and copy it to v and return true, never suspends or loads
+         */
+        bool getCopy(const Key& k, Value& v) {
+            Guard g(lock_);
+            return cache_.getCopy(k, v);
+        }
+
+        template <class V = Value>
+        void insert(const Key& k, V&& v, const size_t & s) {
+            Guard g(lock_);
+            cache_.insert(k, std::forward<V>(v), s);
+        }
+
+        bool remove(const Key& k) {
+            Guard g(lock_);
+            return cache_.remove(k);
+        }
+
+        bool contains(const Key& k) const {
+            Guard g(lock_);
+            return cache_.contains(k);
+        }
+
+        void updateSize(size_t maxSize, size_t elasticity) {
+            Guard g(lock_);
+            cache_.updateSize(maxSize, elasticity);
+        }
+
+        size_t size() const {
+            Guard g(lock_);
+            return cache_.size();
+        }
+
+        bool empty() const {
+            Guard g(lock_);
+            return cache_.empty();
+        }
+
+        void clear() {
+            Guard g(lock_);
+            cache_.clear();
+        }
+
+        size_t getMaxSize() const { return cache_.getMaxSize(); }
+        size_t getElasticity() const { return cache_.getElasticity(); }
+        size_t getMaxAllowedSize() const { return cache_.getMaxAllowedSize(); }
+
+        template <typename F>
+        void cwalk(F& f) const {
+            Guard g(lock_);
+            cache_.cwalk(f);
+        }
+    };
+}
+#endif // __cpp_impl_coroutine
+#endif // ASYNC_LRU_CACHE_HPP
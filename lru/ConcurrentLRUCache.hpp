@@ -0,0 +1,420 @@
+/* @file ConcurrentLRUCache.hpp*/
+#ifndef CONCURRENT_LRU_CACHE_HPP
+#define CONCURRENT_LRU_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    /**
+     * a reader-writer lock made of Stripes shared mutexes, each on its own cache line
+     * A reader locks the stripe of its thread only, so readers on different stripes never write
+     * to the same reader count. A writer locks every stripe in order.
+     */
+    template <size_t Stripes>
+    class StripedSharedMutex {
+        static_assert(Stripes > 0, "StripedSharedMutex needs at least one stripe");
+
+        struct alignas(64) Stripe {
+            std::shared_mutex mutex;
+        };
+
+        Stripe stripes_[Stripes];
+
+    public:
+        /**
+         * the stripe of the calling thread, the same on every call of the thread
+         */
+        static size_t stripe() {
+            static thread_local const size_t probe =
+                std::hash<std::thread::id>()(std::this_thread::get_id());
+            return probe % Stripes;
+        }
+
+        void lock() {
+            for (auto& s : stripes_)
+                s.mutex.lock();
+        }
+
+        bool try_lock() {
+            for (size_t i = 0; i < Stripes; i++) {
+                if (!stripes_[i].mutex.try_lock()) {
+                    while (i > 0)
+                        stripes_[--i].mutex.unlock();
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void unlock() {
+            for (auto& s : stripes_)
+                s.mutex.unlock();
+        }
+
+        void lock_shared() { stripes_[stripe()].mutex.lock_shared(); }
+        bool try_lock_shared() { return stripes_[stripe()].mutex.try_lock_shared(); }
+        void unlock_shared() { stripes_[stripe()].mutex.unlock_shared(); }
+    };
+
+    /**
+     * The ConcurrentLRUCache class templated by
+     *        Key - key type
+     *        Value - value type
+     *        Hash - hash of the key map
+     *        Stripes - number of read lock stripes and read buffers the reading threads are spread over
+     *
+     * A thread-safe LRU cache for read-mostly workloads (BP-Wrapper / Caffeine style).
+     * Lookups run under a striped shared lock (StripedSharedMutex), so concurrent readers don't
+     * contend on one reader count, and never touch the recency list: a hit only records the
+     * entry in a lock-free read buffer picked by the calling thread. The buffers are drained
+     * and replayed on the recency list in batches, either by a writer (which always drains before
+     * changing the cache) or by the reader that fills a buffer, if the exclusive lock is free.
+     * A full buffer drops further hits until it is drained, so the LRU order is approximate
+     * under heavy read load, which is what lets reads scale with the number of cores.
+     * Requires C++17 (std::shared_mutex).
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>, size_t Stripes = 16>
+    class ConcurrentLRUCache {
+        static_assert(Stripes > 0, "ConcurrentLRUCache needs at least one read buffer");
+
+    public:
+        typedef KeyValuePair<Key, Value> node_type;
+        typedef std::list<KeyValuePair<Key, Value>> list_type;
+        typedef std::unordered_map<Key, typename list_type::iterator, Hash> map_type;
+        typedef StripedSharedMutex<Stripes> lock_type;
+        using Guard = std::unique_lock<lock_type>;
+        using SharedGuard = std::shared_lock<lock_type>;
+        using Callback = std::function<void(void *,const KeyValuePair<Key,Value>&)>;
+        using RemoveCallback = std::function<void(void *,KeyValuePair<Key,Value>&&)>;
+        using Executor = std::function<void(std::function<void()>)>;
+    private:
+        // Dissallow copying.
+        ConcurrentLRUCache(const ConcurrentLRUCache&) = delete;
+        ConcurrentLRUCache& operator=(const ConcurrentLRUCache&) = delete;
+        template <class, class> friend class PruneOnExit;
+
+        /**
+         * A bounded buffer of hits waiting to be applied to the recency list.
+         * Readers claim slots with a fetch_add while holding the shared lock, the buffer is only
+         * drained under the exclusive lock, so a slot is never written and read at the same time.
+         */
+        struct alignas(64) ReadBuffer {
+            static constexpr size_t capacity = 32;
+            std::atomic<size_t> writeCount{0};
+            typename list_type::iterator slots[capacity];
+
+            // returns true when the buffer is full and should be drained: every reader finding it
+            // full retries, so a drain skipped by a busy writer lock is not lost
+            bool offer(typename list_type::iterator it) {
+                size_t i = writeCount.fetch_add(1, std::memory_order_relaxed);
+                if (i >= capacity)
+                    return true; // full, the hit is dropped
+                slots[i] = it;
+                return i + 1 >= capacity;
+            }
+        };
+
+        mutable lock_type lock_;
+        map_type cache_;
+        list_type keys_;
+        mutable ReadBuffer buffers_[Stripes];
+        size_t maxSize_;
+        size_t elasticity_;
+        size_t cacheSize_;
+        RemoveCallback removeCallback_;
+        Callback insertCallback_;
+        Executor removeExecutor_;
+        void* insertClientContext_;
+        void* removeClientContext_;
+
+        // must be called with the exclusive lock held
+        void drain() {
+            for (auto& b : buffers_) {
+                size_t n = std::min(b.writeCount.load(std::memory_order_relaxed), ReadBuffer::capacity);
+                for (size_t i = 0; i < n; i++)
+                    keys_.splice(keys_.begin(), keys_, b.slots[i]);
+                b.writeCount.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // returns a copy of the value of k, built under the shared lock, and records the hit
+        Value copyHit(const Key& k, bool& full) {
+            SharedGuard g(lock_);
+            const auto iter = cache_.find(k);
+            if (iter == cache_.end())
+                throw KeyNotFound();
+            full = buffers_[lock_type::stripe()].offer(iter->second);
+            return iter->second->value;
+        }
+
+        // called after a read released the shared lock
+        void tryDrain() {
+            Guard g(lock_, std::try_to_lock);
+            if (g.owns_lock())
+                drain();
+        }
+
+    public:
+        /**
+         * the maxSize is the soft limit of keys and (maxSize + elasticity) is the hard limit
+         * the cache is allowed to grow till (maxSize + elasticity) and is pruned back to maxSize keys
+         * set maxSize = 0 for an unbounded cache
+         * removeCallback runs after the lock is released, see LRUCache
+         */
+        explicit ConcurrentLRUCache(size_t maxSize = 64, size_t elasticity = 10, Callback insertCallback = nullptr,
+        RemoveCallback removeCallback = nullptr,void * insertClientContext = nullptr,void * removeClientContext = nullptr,
+        Executor removeExecutor = nullptr)
+        : maxSize_(maxSize), elasticity_(elasticity), cacheSize_(0),
+          removeCallback_(removeCallback), insertCallback_(insertCallback), removeExecutor_(removeExecutor),
+          insertClientContext_(insertClientContext),removeClientContext_(removeClientContext){}
+
+        virtual ~ConcurrentLRUCache() = default;
+
+        void updateSize(size_t maxSize, size_t elasticity){
+            list_type evicted;
+            {
+                Guard g(lock_);
+                maxSize_ = maxSize;
+                elasticity_ = elasticity;
+                drain();
+                prune(evicted);
+            }
+            notify(evicted);
+        }
+
+        size_t size() const {
+            SharedGuard g(lock_);
+            return cacheSize_;
+        }
+
+        size_t freeSize() const {
+            SharedGuard g(lock_);
+            return maxSize_ + elasticity_ - cacheSize_;
+        }
+
+        bool empty() const {
+            SharedGuard g(lock_);
+            return cache_.empty();
+        }
+
+        void clear() {
+            Guard g(lock_);
+            for (auto& b : buffers_)
+                b.writeCount.store(0, std::memory_order_relaxed);
+            cache_.clear();
+            keys_.clear();
+            cacheSize_ = 0;
+        }
+
+        void insert(const Key& k, const Value& v,const size_t & s,void * insertClientContext) {
+            list_type evicted;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    insertLocked(k, v, s, insertClientContext, evicted);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        void insert(const Key& k, const Value& v,const size_t & s) {
+            insert(k,v,s,nullptr);
+        }
+
+        /**
+         * This function throws
+         * returns a copy of the stored object (if found). There is no get() returning a
+         * reference since the entry may be evicted as soon as the shared lock is released
+         */
+        Value getCopy(const Key& k) {
+            bool full;
+            Value v = copyHit(k, full);
+            if (full)
+                tryDrain();
+            return v;
+        }
+
+        /**
+         * Try to get the value for k and copy it to v and return true
+         */
+        bool getCopy(const Key& k, Value& v) {
+            bool full;
+            {
+                SharedGuard g(lock_);
+                const auto iter = cache_.find(k);
+                if (iter == cache_.end()) {
+                    return false;
+                }
+                full = buffers_[lock_type::stripe()].offer(iter->second);
+                v = iter->second->value;
+            }
+            if (full)
+                tryDrain();
+            return true;
+        }
+
+        /**
+         * getCopy() without recording a hit, the entry keeps its place in the LRU order
+         */
+        bool peek(const Key& k, Value& v) const {
+            SharedGuard g(lock_);
+            const auto iter = cache_.find(k);
+            if (iter == cache_.end()) {
+                return false;
+            }
+            v = iter->second->value;
+            return true;
+        }
+
+        /**
+         * This function throws CallBackFailed if the remove callback fails, the entry is removed anyway
+         */
+        bool remove(const Key& k) {
+            list_type removed;
+            {
+                Guard g(lock_);
+                drain();
+                auto iter = cache_.find(k);
+                if (iter == cache_.end()) {
+                    return false;
+                }
+                size_t s = iter->second->size;
+                removed.splice(removed.end(), keys_, iter->second);
+                cache_.erase(iter);
+                cacheSize_-=s;
+            }
+            notify(removed);
+            return true;
+        }
+
+        bool contains(const Key& k) const {
+            SharedGuard g(lock_);
+            return cache_.find(k) != cache_.end();
+        }
+        size_t getMaxSize() const { return maxSize_; }
+        size_t getElasticity() const { return elasticity_; }
+        size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+
+        /**
+         * walks the entries in LRU order, hits still waiting in the read buffers are not
+         * reflected in that order
+         */
+        template <typename F>
+        void cwalk(F& f) const {
+            SharedGuard g(lock_);
+            std::for_each(keys_.begin(), keys_.end(), f);
+        }
+
+    protected:
+        // must be called with the exclusive lock held, the entries pruned are spliced into evicted
+        void insertLocked(const Key& k, const Value& v,const size_t & s,void * insertClientContext,
+        list_type& evicted) {
+            drain();
+            const auto iter = cache_.find(k);
+
+            if (iter != cache_.end()) {
+                size_t prev_size = iter->second->size;
+                size_t size_diff = s-prev_size;
+                if(s > prev_size && size_diff > maxSize_ + elasticity_ - cacheSize_)
+                    throw TooLargeSize();
+                iter->second->size = s;
+                iter->second->value = v;
+                keys_.splice(keys_.begin(), keys_, iter->second);
+                cacheSize_+=size_diff;
+            }
+            else{
+                if(s > maxSize_ + elasticity_)
+                    throw TooLargeSize();
+                keys_.emplace_front(k, v, s);
+                cacheSize_+=s;
+                cache_[k] = keys_.begin();
+            }
+            // prune() runs after the callback, also if it throws
+            PruneOnExit<ConcurrentLRUCache, list_type> pruner(*this, evicted);
+            if(insertCallback_){
+                try{
+                    // if no specific context is provided of the insert use global context
+                    if(!insertClientContext)
+                        insertCallback_(insertClientContext_,keys_.front());
+                    else
+                        insertCallback_(insertClientContext,keys_.front());
+                }
+                catch(...){
+                    throw CallBackFailed();
+                }
+            }
+        }
+
+        /**
+         * hands the removed entries to the remove callback, must be called without the lock held
+         * (see LRUCache::notify())
+         */
+        void notify(list_type& removed) {
+            if (removed.empty() || !removeCallback_)
+                return;
+            if (removeExecutor_) {
+                auto batch = std::make_shared<list_type>(std::move(removed));
+                RemoveCallback callback = removeCallback_;
+                void* context = removeClientContext_;
+                removeExecutor_([batch, callback, context] () {
+                    for (auto& node : *batch) {
+                        try {
+                            callback(context, std::move(node));
+                        }
+                        catch (...) {
+                        }
+                    }
+                });
+                return;
+            }
+            bool failed = false;
+            for (auto& node : removed) {
+                try{
+                    removeCallback_(removeClientContext_, std::move(node));
+                }
+                catch(...){
+                    failed = true;
+                }
+            }
+            if (failed)
+                throw CallBackFailed();
+        }
+
+        // must be called with the exclusive lock held and the read buffers drained
+        size_t prune(list_type& evicted) {
+            size_t maxAllowed = maxSize_ + elasticity_;
+            if (maxSize_ == 0 || cacheSize_ < maxAllowed) {
+                return 0;
+            }
+            size_t removedSize = 0;
+            while (cacheSize_ > maxSize_) {
+                //Remove from the LRU, the callback runs once the lock is released
+                size_t s = keys_.back().size;
+                cache_.erase(keys_.back().key);
+                evicted.splice(evicted.end(), keys_, std::prev(keys_.end()));
+                removedSize+=s;
+                cacheSize_-=s;
+            }
+            return removedSize;
+        }
+    };
+}
+#endif // CONCURRENT_LRU_CACHE_HPP
@@ -0,0 +1,514 @@
+/* @file EvictionPolicies.hpp*/
+#ifndef EVICTION_POLICIES_HPP
+#define EVICTION_POLICIES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    /**
+     * CLOCK approximation of LRU
+     * The entries form a ring swept by a hand. A hit only sets the reference bit of the entry,
+     * victim() advances the hand, giving every referenced entry a second chance by clearing
+     * its bit, and stops at the first unreferenced one. New entries are placed right behind the
+     * hand so they are the last ones it reaches.
+     */
+    template <typename K, typename V>
+    class ClockPolicy {
+    public:
+        typedef std::list<KeyValuePair<K, V>> list_type;
+        typedef typename list_type::iterator iterator;
+        static constexpr std::uint8_t kReferenced = 0x1;
+        // touch() only sets kReferenced, hits promote under the shared lock
+        static constexpr bool sharedTouch = true;
+    private:
+        list_type keys_;
+        iterator hand_ = keys_.end();
+    public:
+        ClockPolicy() = default;
+        ClockPolicy(const ClockPolicy&) = delete;
+        ClockPolicy& operator=(const ClockPolicy&) = delete;
+
+        template <typename... Args>
+        iterator emplace(Args&&... args) {
+            return keys_.emplace(hand_, std::forward<Args>(args)...);
+        }
+        void touch(iterator it) {
+            it->flags |= kReferenced;
+        }
+        void reweigh(iterator it, const size_t& s) {
+            it->size = s;
+        }
+        iterator victim() {
+            for (;;) {
+                if (hand_ == keys_.end())
+                    hand_ = keys_.begin();
+                if (!(hand_->flags & kReferenced))
+                    return hand_;
+                hand_->flags &= ~kReferenced;
+                ++hand_;
+            }
+        }
+        void erase(iterator it, list_type& out) {
+            if (it == hand_)
+                ++hand_;
+            out.splice(out.end(), keys_, it);
+        }
+        void evict(iterator it, list_type& out) {
+            erase(it, out);
+        }
+        void resize(size_t) {}
+        void clear() {
+            keys_.clear();
+            hand_ = keys_.end();
+        }
+        template <typename F>
+        void walk(F& f) const {
+            std::for_each(keys_.begin(), keys_.end(), f);
+        }
+    };
+
+    /**
+     * CLOCK-Pro (Jiang, Chen, Zhang - USENIX 2005)
+     * Entries are hot or cold. New entries start cold and in their test period; a cold entry that
+     * is hit again during its test period has a short reuse distance and is promoted to hot.
+     * The cold hand only evicts cold entries, the hot hand demotes unreferenced hot entries once
+     * there are more hot entries than the current target. Evicted cold entries that were still
+     * being tested are remembered as non-resident (by hash only) for as many entries as the
+     * cache holds: if such a key is inserted again it comes back hot and the cold target grows,
+     * if test periods run out without reuse the cold target shrinks.
+     * This keeps one-time scans from flushing the frequently reused entries.
+     */
+    template <typename K, typename V>
+    class ClockProPolicy {
+    public:
+        typedef std::list<KeyValuePair<K, V>> list_type;
+        typedef typename list_type::iterator iterator;
+        static constexpr std::uint8_t kReferenced = 0x1;
+        static constexpr std::uint8_t kHot = 0x2;
+        static constexpr std::uint8_t kTest = 0x4;
+        // touch() only sets kReferenced, hits promote under the shared lock
+        static constexpr bool sharedTouch = true;
+    private:
+        list_type keys_;
+        iterator coldHand_ = keys_.end();
+        iterator hotHand_ = keys_.end();
+        size_t hotCount_ = 0;
+        size_t coldCount_ = 0;
+        size_t coldTarget_ = 1;
+        // non-resident cold entries, as hashes in FIFO order
+        std::deque<size_t> ghostOrder_;
+        std::unordered_set<size_t> ghosts_;
+        std::hash<K> hash_;
+
+        void advance(iterator& hand) {
+            if (hand == keys_.end() || ++hand == keys_.end())
+                hand = keys_.begin();
+        }
+
+        void endTest(KeyValuePair<K, V>& n) {
+            n.flags &= ~kTest;
+            if (coldTarget_ > 1)
+                coldTarget_--;
+        }
+
+        // demote one hot entry, ending the test periods of the cold entries passed on the way
+        void runHotHand() {
+            if (hotHand_ == keys_.end())
+                hotHand_ = keys_.begin();
+            for (;;) {
+                auto& n = *hotHand_;
+                if (!(n.flags & kHot)) {
+                    if (n.flags & kTest)
+                        endTest(n);
+                }
+                else if (n.flags & kReferenced) {
+                    n.flags &= ~kReferenced;
+                }
+                else {
+                    n.flags &= ~kHot;
+                    hotCount_--;
+                    coldCount_++;
+                    advance(hotHand_);
+                    return;
+                }
+                advance(hotHand_);
+            }
+        }
+
+        void remember(size_t h) {
+            if (!ghosts_.insert(h).second)
+                return;
+            ghostOrder_.push_back(h);
+            // keep at most as many non-resident entries as resident ones
+            while (ghostOrder_.size() > hotCount_ + coldCount_ + 1) {
+                ghosts_.erase(ghostOrder_.front());
+                ghostOrder_.pop_front();
+                if (coldTarget_ > 1)
+                    coldTarget_--;
+            }
+        }
+
+        void unlink(iterator it, list_type& out) {
+            if (it == coldHand_)
+                advance(coldHand_);
+            if (it == hotHand_)
+                advance(hotHand_);
+            if (it->flags & kHot)
+                hotCount_--;
+            else
+                coldCount_--;
+            out.splice(out.end(), keys_, it);
+            if (keys_.empty())
+                coldHand_ = hotHand_ = keys_.end();
+        }
+
+    public:
+        ClockProPolicy() = default;
+        ClockProPolicy(const ClockProPolicy&) = delete;
+        ClockProPolicy& operator=(const ClockProPolicy&) = delete;
+
+        template <typename... Args>
+        iterator emplace(Args&&... args) {
+            auto it = keys_.emplace(coldHand_, std::forward<Args>(args)...);
+            if (ghosts_.erase(hash_(it->key))) {
+                // reused within its test period, the key is worth keeping
+                it->flags = kHot;
+                hotCount_++;
+                coldTarget_ = std::min(coldTarget_ + 1, hotCount_ + coldCount_);
+            }
+            else {
+                it->flags = kTest;
+                coldCount_++;
+            }
+            return it;
+        }
+        void touch(iterator it) {
+            it->flags |= kReferenced;
+        }
+        void reweigh(iterator it, const size_t& s) {
+            it->size = s;
+        }
+        iterator victim() {
+            for (;;) {
+                size_t resident = hotCount_ + coldCount_;
+                size_t hotTarget = resident > coldTarget_ ? resident - coldTarget_ : 0;
+                if (coldCount_ == 0 || hotCount_ > hotTarget) {
+                    runHotHand();
+                    continue;
+                }
+                if (coldHand_ == keys_.end())
+                    coldHand_ = keys_.begin();
+                auto& n = *coldHand_;
+                if (n.flags & kHot) {
+                    advance(coldHand_);
+                }
+                else if (!(n.flags & kReferenced)) {
+                    return coldHand_;
+                }
+                else if (n.flags & kTest) {
+                    n.flags = kHot;
+                    hotCount_++;
+                    coldCount_--;
+                    coldTarget_ = std::min(coldTarget_ + 1, resident);
+                    advance(coldHand_);
+                }
+                else {
+                    n.flags = kTest;
+                    advance(coldHand_);
+                }
+            }
+        }
+        void erase(iterator it, list_type& out) {
+            unlink(it, out);
+        }
+        void evict(iterator it, list_type& out) {
+            if (it->flags & kTest)
+                remember(hash_(it->key));
+            unlink(it, out);
+        }
+        void resize(size_t) {}
+        void clear() {
+            keys_.clear();
+            coldHand_ = hotHand_ = keys_.end();
+            hotCount_ = coldCount_ = 0;
+            coldTarget_ = 1;
+            ghosts_.clear();
+            ghostOrder_.clear();
+        }
+        template <typename F>
+        void walk(F& f) const {
+            std::for_each(keys_.begin(), keys_.end(), f);
+        }
+    };
+
+    /**
+     * Count-min sketch with 4-bit counters used to estimate how often a key was seen
+     * Every key maps to one counter in each of 4 rows, the estimate is the smallest of them.
+     * Counters are packed 16 to a 64-bit word. After 10 increments per word all counters are
+     * halved, so the sketch forgets old popularity and follows the current workload.
+     */
+    class FrequencySketch {
+    private:
+        std::vector<std::uint64_t> table_;
+        size_t mask_ = 0;
+        size_t sampleSize_ = 0;
+        size_t additions_ = 0;
+
+        static std::uint64_t mix(std::uint64_t h, int row) {
+            static const std::uint64_t seeds[4] = {
+                0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL };
+            h = (h + seeds[row]) * seeds[row];
+            return h ^ (h >> 32);
+        }
+
+        void reset() {
+            for (auto& w : table_)
+                w = (w >> 1) & 0x7777777777777777ULL;
+            additions_ /= 2;
+        }
+
+    public:
+        /**
+         * size the table for about n distinct keys
+         * A key keeps its counters when the table grows: the table is doubled by copying it
+         * behind itself, and the new index of a key only adds a bit to the old one.
+         */
+        void ensureCapacity(size_t n) {
+            size_t want = 16;
+            while (want < n)
+                want <<= 1;
+            if (want <= table_.size())
+                return;
+            if (table_.empty())
+                table_.assign(16, 0);
+            for (size_t old = table_.size(); old < want; old *= 2) {
+                table_.resize(2 * old);
+                std::copy(table_.begin(), table_.begin() + old, table_.begin() + old);
+            }
+            mask_ = want - 1;
+            sampleSize_ = 10 * want;
+        }
+
+        /**
+         * the number of distinct keys the table is sized for
+         */
+        size_t capacity() const {
+            return table_.size();
+        }
+
+        unsigned frequency(size_t hash) const {
+            if (table_.empty())
+                return 0;
+            unsigned freq = 15;
+            for (int row = 0; row < 4; row++) {
+                std::uint64_t h = mix(hash, row);
+                unsigned shift = static_cast<unsigned>((h >> 60) << 2);
+                freq = std::min(freq, static_cast<unsigned>((table_[h & mask_] >> shift) & 0xf));
+            }
+            return freq;
+        }
+
+        void increment(size_t hash) {
+            if (table_.empty())
+                return;
+            bool added = false;
+            for (int row = 0; row < 4; row++) {
+                std::uint64_t h = mix(hash, row);
+                unsigned shift = static_cast<unsigned>((h >> 60) << 2);
+                std::uint64_t& w = table_[h & mask_];
+                if (((w >> shift) & 0xf) != 0xf) {
+                    w += 1ULL << shift;
+                    added = true;
+                }
+            }
+            if (added && ++additions_ >= sampleSize_)
+                reset();
+        }
+
+        void clear() {
+            std::fill(table_.begin(), table_.end(), 0);
+            additions_ = 0;
+        }
+    };
+
+    /**
+     * W-TinyLFU (Einziger, Friedman, Manes - ACM ToS 2017)
+     * New entries go to a small LRU window (1% of maxSize). The rest of the cache is a segmented
+     * LRU: entries admitted from the window start in probation and move to the protected
+     * segment (80% of the main region) when hit again. When the window is over its share its
+     * least recent entry competes with the least recent entry of probation, and only the one
+     * the FrequencySketch has seen more often stays. Keys touched once by a scan lose against
+     * the established working set, so the scan passes through the window without flushing it.
+     * Hits and inserts are counted in the sketch, which is sized by the number of entries and
+     * grows, keeping its counts, while the cache fills up. maxSize may be a weight in bytes, so
+     * it doesn't size the sketch.
+     */
+    template <typename K, typename V>
+    class TinyLFUPolicy {
+    public:
+        typedef std::list<KeyValuePair<K, V>> list_type;
+        typedef typename list_type::iterator iterator;
+        static constexpr std::uint8_t kRegionMask = 0x3;
+        static constexpr std::uint8_t kWindow = 0x0;
+        static constexpr std::uint8_t kProbation = 0x1;
+        static constexpr std::uint8_t kProtected = 0x2;
+    private:
+        // most recently used entry first in every region
+        list_type window_;
+        list_type probation_;
+        list_type protected_;
+        size_t windowWeight_ = 0;
+        size_t probationWeight_ = 0;
+        size_t protectedWeight_ = 0;
+        size_t windowMax_ = 1;
+        size_t mainMax_ = 0;
+        size_t protectedMax_ = 0;
+        FrequencySketch sketch_;
+        std::hash<K> hash_;
+
+        list_type& region(iterator it) {
+            switch (it->flags & kRegionMask) {
+                case kProbation: return probation_;
+                case kProtected: return protected_;
+                default: return window_;
+            }
+        }
+
+        size_t& weight(std::uint8_t r) {
+            switch (r) {
+                case kProbation: return probationWeight_;
+                case kProtected: return protectedWeight_;
+                default: return windowWeight_;
+            }
+        }
+
+        void moveTo(iterator it, std::uint8_t to) {
+            weight(it->flags & kRegionMask) -= it->size;
+            weight(to) += it->size;
+            list_type& src = region(it);
+            it->flags = static_cast<std::uint8_t>((it->flags & ~kRegionMask) | to);
+            list_type& dst = region(it);
+            dst.splice(dst.begin(), src, it);
+        }
+
+        unsigned frequency(iterator it) const {
+            return sketch_.frequency(hash_(it->key));
+        }
+
+    public:
+        TinyLFUPolicy() = default;
+        TinyLFUPolicy(const TinyLFUPolicy&) = delete;
+        TinyLFUPolicy& operator=(const TinyLFUPolicy&) = delete;
+
+        template <typename... Args>
+        iterator emplace(Args&&... args) {
+            window_.emplace_front(std::forward<Args>(args)...);
+            auto it = window_.begin();
+            windowWeight_ += it->size;
+            size_t entries = window_.size() + probation_.size() + protected_.size();
+            if (entries > sketch_.capacity())
+                sketch_.ensureCapacity(entries);
+            sketch_.increment(hash_(it->key));
+            return it;
+        }
+        void touch(iterator it) {
+            sketch_.increment(hash_(it->key));
+            switch (it->flags & kRegionMask) {
+                case kWindow:
+                    window_.splice(window_.begin(), window_, it);
+                    break;
+                case kProbation:
+                    moveTo(it, kProtected);
+                    // demote the least recent protected entries back to probation
+                    while (protectedWeight_ > protectedMax_ && protected_.size() > 1)
+                        moveTo(std::prev(protected_.end()), kProbation);
+                    break;
+                default:
+                    protected_.splice(protected_.begin(), protected_, it);
+                    break;
+            }
+        }
+        void reweigh(iterator it, const size_t& s) {
+            size_t& w = weight(it->flags & kRegionMask);
+            w = w - it->size + s;
+            it->size = s;
+        }
+        iterator victim() {
+            for (;;) {
+                if (windowWeight_ > windowMax_ && !window_.empty()) {
+                    auto candidate = std::prev(window_.end());
+                    if (probationWeight_ + protectedWeight_ < mainMax_ ||
+                        (probation_.empty() && protected_.empty())) {
+                        // the main region still has room, the candidate is admitted for free
+                        moveTo(candidate, kProbation);
+                        continue;
+                    }
+                    auto mainVictim = probation_.empty() ? std::prev(protected_.end())
+                                                         : std::prev(probation_.end());
+                    if (frequency(candidate) > frequency(mainVictim)) {
+                        moveTo(candidate, kProbation);
+                        return mainVictim;
+                    }
+                    return candidate;
+                }
+                if (!probation_.empty())
+                    return std::prev(probation_.end());
+                if (!protected_.empty())
+                    return std::prev(protected_.end());
+                return std::prev(window_.end());
+            }
+        }
+        void erase(iterator it, list_type& out) {
+            weight(it->flags & kRegionMask) -= it->size;
+            out.splice(out.end(), region(it), it);
+        }
+        void evict(iterator it, list_type& out) {
+            erase(it, out);
+        }
+        void resize(size_t maxSize) {
+            windowMax_ = std::max<size_t>(maxSize / 100, 1);
+            mainMax_ = maxSize - std::min(maxSize, windowMax_);
+            protectedMax_ = mainMax_ * 8 / 10;
+        }
+        void clear() {
+            window_.clear();
+            probation_.clear();
+            protected_.clear();
+            windowWeight_ = probationWeight_ = protectedWeight_ = 0;
+            sketch_.clear();
+        }
+        const FrequencySketch& sketch() const {
+            return sketch_;
+        }
+        template <typename F>
+        void walk(F& f) const {
+            std::for_each(window_.begin(), window_.end(), f);
+            std::for_each(protected_.begin(), protected_.end(), f);
+            std::for_each(probation_.begin(), probation_.end(), f);
+        }
+    };
+
+    /**
+     * LRUCache with the CLOCK / CLOCK-Pro / W-TinyLFU policy and the default map
+     */
+    template <class Key, class Value, class Lock = NullLock>
+    using ClockCache = LRUCache<Key, Value, Lock, LRUMap<Key, Value>, ClockPolicy>;
+
+    template <class Key, class Value, class Lock = NullLock>
+    using ClockProCache = LRUCache<Key, Value, Lock, LRUMap<Key, Value>, ClockProPolicy>;
+
+    template <class Key, class Value, class Lock = NullLock>
+    using TinyLFUCache = LRUCache<Key, Value, Lock, LRUMap<Key, Value>, TinyLFUPolicy>;
+}
+#endif // EVICTION_POLICIES_HPP
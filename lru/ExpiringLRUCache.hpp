@@ -0,0 +1,354 @@
+/* @file ExpiringLRUCache.hpp*/
+#ifndef EXPIRING_LRU_CACHE_HPP
+#define EXPIRING_LRU_CACHE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "LRUCache.hpp"
+#include "TimerWheel.hpp"
+
+namespace lru {
+
+    /**
+     * The ExpiringLRUCache class templated by
+     *        Key - key type
+     *        Value - value type
+     *        Lock - a lock type like std::mutex (default: NullLock = no synchronization)
+     *        Clock - the clock the time to live is measured with
+     *        Policy - the eviction policy of the underlying LRUCache
+     *
+     * An LRUCache whose entries also expire a time to live after they were written.
+     * Expired entries are never returned: get() checks the deadline of the entry it finds and
+     * drops it if it has passed. Deadlines are kept in a TimerWheel with a configurable tick
+     * (default 1ms) and expire() advances it to the current time, removing every expired entry
+     * in amortized O(1) each; it runs on every insert and can be called from a background
+     * thread or timer to bound the memory held by expired entries.
+     * With refreshAfterWrite set, getOrLoad() reloads an entry older than that on access while
+     * the other callers keep getting the current value until the reload is done. A reload that
+     * fails keeps the current value, a later access retries it.
+     */
+    template <class Key, class Value, class Lock = NullLock,
+    class Clock = std::chrono::steady_clock,
+    template <typename, typename> class Policy = LRUPolicy>
+    class ExpiringLRUCache {
+
+    public:
+        typedef typename Clock::duration duration;
+        typedef typename Clock::time_point time_point;
+        typedef Lock lock_type;
+        using Guard = std::lock_guard<lock_type>;
+
+        /**
+         * a value with the ticks it expires and has to be refreshed at, and the deadline of its
+         * item in the timer wheel
+         */
+        struct Entry {
+            Value value;
+            std::uint64_t expiresAt;
+            std::uint64_t refreshAt;
+            std::uint64_t scheduledAt;
+            bool refreshing;
+            template <class V>
+            Entry(V&& v, std::uint64_t e, std::uint64_t r, std::uint64_t sch)
+            : value(std::forward<V>(v)), expiresAt(e), refreshAt(r), scheduledAt(sch), refreshing(false) {}
+        };
+        typedef LRUCache<Key, Entry, NullLock, LRUMap<Key, Entry>, Policy> cache_type;
+        typedef typename cache_type::node_type node_type;
+    private:
+        // Dissallow copying.
+        ExpiringLRUCache(const ExpiringLRUCache&) = delete;
+        ExpiringLRUCache& operator=(const ExpiringLRUCache&) = delete;
+
+        mutable Lock lock_;
+        cache_type cache_;
+        /**
+         * every entry has one item (key, scheduledAt) in the wheel. An overwrite expiring later
+         * keeps the item, which moves the entry to its new deadline when it fires. Only a write
+         * with an earlier deadline schedules another item. Items left by removed entries, or
+         * whose deadline is no longer the entry's, are skipped when they fire.
+         */
+        TimerWheel<Key> wheel_;
+        time_point epoch_;
+        duration tick_;
+        duration ttl_;
+        duration refreshAfter_;
+        std::unordered_map<Key, std::shared_future<Value>> loading_;
+
+        std::uint64_t ticks(time_point t) const {
+            return t <= epoch_ ? 0 : static_cast<std::uint64_t>((t - epoch_) / tick_);
+        }
+
+        std::uint64_t after(std::uint64_t now, duration d) const {
+            // rounded up so that an entry never expires early
+            return now + static_cast<std::uint64_t>((d + tick_ - duration(1)) / tick_);
+        }
+
+        // must be called with lock_ held
+        size_t expireLocked(std::uint64_t now) {
+            size_t removed = 0;
+            std::vector<std::pair<Key, std::uint64_t>> later;
+            wheel_.advance(now, [&] (std::uint64_t deadline, Key&& k) {
+                Entry* e = const_cast<Entry*>(peekLocked(k));
+                if (!e || e->scheduledAt != deadline)
+                    return;
+                if (e->expiresAt <= now) {
+                    cache_.remove(k);
+                    removed++;
+                }
+                else {
+                    // overwritten since, the item follows the entry to its new deadline
+                    e->scheduledAt = e->expiresAt;
+                    later.emplace_back(std::move(k), e->expiresAt);
+                }
+            });
+            for (auto& item : later)
+                wheel_.schedule(std::move(item.first), item.second);
+            return removed;
+        }
+
+        // the sweep and lookups that don't count as an access must not promote the entry
+        const Entry* peekLocked(const Key& k) {
+            if (!cache_.contains(k))
+                return nullptr;
+            return &cache_.peek(k);
+        }
+
+        // returns the live entry of k or nullptr, dropping it if it expired
+        Entry* findLocked(const Key& k, std::uint64_t now, bool promote = true) {
+            if (!cache_.contains(k))
+                return nullptr;
+            Entry& e = const_cast<Entry&>(promote ? cache_.get(k) : cache_.peek(k));
+            if (e.expiresAt <= now) {
+                cache_.remove(k);
+                return nullptr;
+            }
+            return &e;
+        }
+
+        template <class V>
+        void insertLocked(const Key& k, V&& v, const size_t& s, duration ttl, std::uint64_t now) {
+            std::uint64_t expiresAt = after(now, ttl);
+            std::uint64_t refreshAt = refreshAfter_ > duration::zero() ? after(now, refreshAfter_) : expiresAt;
+            // the item of the entry replaced is kept if it doesn't fire after the new deadline
+            const Entry* old = peekLocked(k);
+            bool reuse = old && old->scheduledAt <= expiresAt;
+            std::uint64_t scheduledAt = reuse ? old->scheduledAt : expiresAt;
+            cache_.emplace(k, s, std::forward<V>(v), expiresAt, refreshAt, scheduledAt);
+            if (!reuse)
+                wheel_.schedule(k, expiresAt);
+            expireLocked(now);
+        }
+
+    public:
+        /**
+         * maxSize and elasticity as in LRUCache
+         * ttl is the default time to live of an entry after it was written
+         * refreshAfterWrite is the age after which getOrLoad() reloads an entry (zero: never)
+         * tick is the resolution of the deadlines
+         */
+        explicit ExpiringLRUCache(size_t maxSize, size_t elasticity, duration ttl,
+        duration refreshAfterWrite = duration::zero(),
+        duration tick = std::chrono::duration_cast<duration>(std::chrono::milliseconds(1)))
+        : cache_(maxSize, elasticity), epoch_(Clock::now()),
+          tick_(tick > duration::zero() ? tick : duration(1)),
+          ttl_(ttl), refreshAfter_(refreshAfterWrite) {}
+
+        virtual ~ExpiringLRUCache() = default;
+
+        void updateSize(size_t maxSize, size_t elasticity) {
+            Guard g(lock_);
+            cache_.updateSize(maxSize, elasticity);
+        }
+
+        /**
+         * the size of the cached entries, expired ones included until expire() removes them
+         */
+        size_t size() const {
+            Guard g(lock_);
+            return cache_.size();
+        }
+
+        bool empty() const {
+            Guard g(lock_);
+            return cache_.empty();
+        }
+
+        void clear() {
+            Guard g(lock_);
+            cache_.clear();
+            wheel_.clear();
+        }
+
+        /**
+         * inserts or replaces the value of k, expiring after the default time to live
+         */
+        template <class V = Value>
+        void insert(const Key& k, V&& v, const size_t & s) {
+            insert(k, std::forward<V>(v), s, ttl_);
+        }
+
+        /**
+         * inserts or replaces the value of k, expiring after ttl
+         */
+        template <class V = Value>
+        void insert(const Key& k, V&& v, const size_t & s, duration ttl) {
+            Guard g(lock_);
+            insertLocked(k, std::forward<V>(v), s, ttl, ticks(Clock::now()));
+        }
+
+        /**
+         * This function throws KeyNotFound for missing and expired keys
+         * The const reference returned here is only
+         * guaranteed to be valid till the next insert/delete
+         */
+        const Value& get(const Key& k) {
+            Guard g(lock_);
+            Entry* e = findLocked(k, ticks(Clock::now()));
+            if (!e)
+                throw KeyNotFound();
+            return e->value;
+        }
+
+        Value getCopy(const Key& k) {
+            return get(k);
+        }
+
+        bool getCopy(const Key& k, Value& v) {
+            Guard g(lock_);
+            Entry* e = findLocked(k, ticks(Clock::now()));
+            if (!e)
+                return false;
+            v = e->value;
+            return true;
+        }
+
+        /**
+         * returns the live value of k or loads it with loader(k), with a single load per key in
+         * flight (see LRUCache::getOrLoad()). An entry past refreshAfterWrite is returned as is
+         * to everybody but the caller that reloads it. If the reload fails, that caller gets the
+         * current value too and the error is dropped, unless the entry expired meanwhile.
+         */
+        template <class Loader>
+        Value getOrLoad(const Key& k, Loader&& loader, const size_t & s = 1) {
+            std::promise<Value> promise;
+            std::shared_future<Value> pending;
+            bool refresh = false;
+            {
+                Guard g(lock_);
+                std::uint64_t now = ticks(Clock::now());
+                Entry* e = findLocked(k, now);
+                if (e && (e->refreshAt > now || e->refreshing))
+                    return e->value;
+                if (e) {
+                    // this caller refreshes, the entry stays readable meanwhile
+                    e->refreshing = true;
+                    refresh = true;
+                }
+                else {
+                    const auto l = loading_.find(k);
+                    if (l != loading_.end())
+                        pending = l->second;
+                    else
+                        loading_.emplace(k, promise.get_future().share());
+                }
+            }
+            if (pending.valid())
+                return pending.get();
+            // a refresh isn't registered in loading_, the entry serves the other callers
+            bool registered = !refresh;
+            try {
+                Value v = loader(k);
+                {
+                    Guard g(lock_);
+                    if (registered) {
+                        loading_.erase(k);
+                        registered = false;
+                    }
+                    insertLocked(k, v, s, ttl_, ticks(Clock::now()));
+                }
+                if (!refresh)
+                    promise.set_value(v);
+                return v;
+            }
+            catch (...) {
+                Guard g(lock_);
+                if (registered)
+                    loading_.erase(k);
+                if (refresh) {
+                    // keep serving the current value, a later access retries the refresh
+                    Entry* e = findLocked(k, ticks(Clock::now()), false);
+                    if (e) {
+                        e->refreshing = false;
+                        return e->value;
+                    }
+                }
+                else {
+                    promise.set_exception(std::current_exception());
+                }
+                throw;
+            }
+        }
+
+        /**
+         * get() without promoting the entry
+         * This function throws KeyNotFound for missing and expired keys
+         */
+        const Value& peek(const Key& k) {
+            Guard g(lock_);
+            Entry* e = findLocked(k, ticks(Clock::now()), false);
+            if (!e)
+                throw KeyNotFound();
+            return e->value;
+        }
+
+        bool remove(const Key& k) {
+            Guard g(lock_);
+            return cache_.remove(k);
+        }
+
+        /**
+         * true if k is cached and not expired, does not promote the entry
+         */
+        bool contains(const Key& k) {
+            Guard g(lock_);
+            return findLocked(k, ticks(Clock::now()), false) != nullptr;
+        }
+
+        /**
+         * the number of deadlines pending in the timer wheel, one per entry unless writes
+         * shortened the time to live of an entry
+         */
+        size_t scheduled() const {
+            Guard g(lock_);
+            return wheel_.size();
+        }
+
+        /**
+         * removes every entry that expired by now, returns how many were removed
+         * meant to be called periodically by a background thread or timer
+         */
+        size_t expire() {
+            Guard g(lock_);
+            return expireLocked(ticks(Clock::now()));
+        }
+
+        size_t getMaxSize() const { return cache_.getMaxSize(); }
+        size_t getElasticity() const { return cache_.getElasticity(); }
+        size_t getMaxAllowedSize() const { return cache_.getMaxAllowedSize(); }
+        duration getTimeToLive() const { return ttl_; }
+
+        template <typename F>
+        void cwalk(F& f) const {
+            Guard g(lock_);
+            cache_.cwalk(f);
+        }
+    };
+}
+#endif // EXPIRING_LRU_CACHE_HPP
@@ -0,0 +1,641 @@
+/* @file FlatLRUCache.hpp*/
+#ifndef FLAT_LRU_CACHE_HPP
+#define FLAT_LRU_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LRU_FLAT_SSE2 1
+#endif
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    namespace flat_detail {
+        // control byte of a slot: the 7 bit tag of the key in a full slot, or one of these
+        static const std::int8_t kEmpty = -128;
+        static const std::int8_t kDeleted = -2;
+        // slots are probed a group at a time
+        static const size_t kGroup = 16;
+        static const std::uint32_t kNone = 0xFFFFFFFFu;
+        static const size_t kNoSlot = static_cast<size_t>(-1);
+
+        // bit i is set for every control byte i of the group equal to c
+        inline std::uint32_t match(const std::int8_t* group, std::int8_t c) {
+#ifdef LRU_FLAT_SSE2
+            __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c))));
+#else
+            std::uint32_t bits = 0;
+            for (size_t i = 0; i < kGroup; i++)
+                bits |= static_cast<std::uint32_t>(group[i] == c) << i;
+            return bits;
+#endif
+        }
+
+        inline unsigned lowestBit(std::uint32_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctz(bits));
+#else
+            unsigned i = 0;
+            while (!(bits & 1)) {
+                bits >>= 1;
+                i++;
+            }
+            return i;
+#endif
+        }
+
+        // the MurmurHash3 finalizer, std::hash of an integer is usually the integer itself
+        inline std::uint64_t mix(std::uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+    }
+
+    /**
+     * The FlatLRUCache class templated by
+     *        Key - key type, trivially copyable
+     *        Value - value type, trivially copyable
+     *        Lock - a lock type like std::mutex (default: NullLock = no synchronization)
+     *        Hash - hash of the key
+     *        KeyEqual - equality of the key
+     *
+     * Same interface and size semantics as IntrusiveLRUCache, laid out for density when there are
+     * many small entries. The entries live in one contiguous array and are linked in the LRU list
+     * by 32 bit indices, sizes are 32 bit too, so an entry with a 64 bit key and a 32 bit value
+     * takes 24 bytes. The hash table is an array of 32 bit entry indices with a control byte per
+     * slot holding 7 bits of the hash; a lookup compares the tags of a group of 16 slots at once
+     * (SSE2, or a scalar loop elsewhere) and only reads the entries whose tag matches. With the
+     * table at most 7/8 full this is about 30 bytes per entry instead of ~100 for LRUCache.
+     * Limited to 2^32 - 1 entries.
+     */
+    template <class Key, class Value, class Lock = NullLock,
+    class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class FlatLRUCache {
+        static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                      "FlatLRUCache needs trivially copyable keys and values");
+
+    public:
+        /**
+         * lru cache entry, linked in the LRU list (prev is towards the most recent entry)
+         */
+        struct Node {
+            Key key;
+            Value value;
+            std::uint32_t size;
+            std::uint32_t prev;
+            std::uint32_t next;
+        };
+        typedef Node node_type;
+        typedef Lock lock_type;
+        using Guard = std::lock_guard<lock_type>;
+        using SharedGuard = ReadGuard<lock_type>;
+        using Callback = std::function<void(void *,const node_type&)>;
+        using RemoveCallback = std::function<void(void *,node_type&&)>;
+    private:
+        // Dissallow copying.
+        FlatLRUCache(const FlatLRUCache&) = delete;
+        FlatLRUCache& operator=(const FlatLRUCache&) = delete;
+        template <class, class> friend class PruneOnExit;
+
+        mutable Lock lock_;
+        std::vector<Node> nodes_;
+        std::vector<std::int8_t> ctrl_;
+        std::vector<std::uint32_t> slots_;
+        std::uint32_t head_; // most recently used
+        std::uint32_t tail_; // least recently used
+        std::uint32_t free_; // unused nodes, linked through next
+        size_t count_;
+        // empty slots that can still be filled before the table is rehashed
+        size_t growthLeft_;
+        Hash hash_;
+        KeyEqual equal_;
+        size_t maxSize_;
+        size_t elasticity_;
+        size_t cacheSize_;
+        RemoveCallback removeCallback_;
+        Callback insertCallback_;
+        void* insertClientContext_;
+        void* removeClientContext_;
+
+        // keys hashed and prefetched ahead of their probes in the batch operations
+        static constexpr size_t kBatch = 16;
+
+        size_t groupMask() const { return ctrl_.size() / flat_detail::kGroup - 1; }
+
+        static std::int8_t tagOf(std::uint64_t h) { return static_cast<std::int8_t>(h & 0x7F); }
+
+        template <class K>
+        std::uint64_t hashOf(const K& k) const {
+            return flat_detail::mix(static_cast<std::uint64_t>(hash_(k)));
+        }
+
+        void prefetch(std::uint64_t h) const {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(&ctrl_[((h >> 7) & groupMask()) * flat_detail::kGroup]);
+#else
+            (void)h;
+#endif
+        }
+
+        /**
+         * returns the slot whose node satisfies pred, or kNoSlot once a group with an empty slot
+         * is reached. Groups are visited in triangular steps, which covers them all since their
+         * number is a power of two, and the table always keeps empty slots.
+         */
+        template <class Pred>
+        size_t probe(std::uint64_t h, Pred pred) const {
+            size_t mask = groupMask();
+            size_t g = (h >> 7) & mask;
+            std::int8_t tag = tagOf(h);
+            for (size_t step = 1; ; step++) {
+                const std::int8_t* group = &ctrl_[g * flat_detail::kGroup];
+                for (std::uint32_t bits = flat_detail::match(group, tag); bits; bits &= bits - 1) {
+                    size_t i = g * flat_detail::kGroup + flat_detail::lowestBit(bits);
+                    if (pred(slots_[i]))
+                        return i;
+                }
+                if (flat_detail::match(group, flat_detail::kEmpty))
+                    return flat_detail::kNoSlot;
+                g = (g + step) & mask;
+            }
+        }
+
+        template <class K>
+        size_t find(const K& k, std::uint64_t h) const {
+            return probe(h, [&] (std::uint32_t n) { return equal_(nodes_[n].key, k); });
+        }
+
+        // the slot of a node in the table, found by index without comparing keys
+        size_t slotOf(std::uint32_t n) const {
+            return probe(hashOf(nodes_[n].key), [n] (std::uint32_t s) { return s == n; });
+        }
+
+        // the first empty or deleted slot of the probe sequence of h
+        size_t freeSlot(std::uint64_t h) const {
+            size_t mask = groupMask();
+            size_t g = (h >> 7) & mask;
+            for (size_t step = 1; ; step++) {
+                const std::int8_t* group = &ctrl_[g * flat_detail::kGroup];
+                std::uint32_t bits = flat_detail::match(group, flat_detail::kEmpty) |
+                                     flat_detail::match(group, flat_detail::kDeleted);
+                if (bits)
+                    return g * flat_detail::kGroup + flat_detail::lowestBit(bits);
+                g = (g + step) & mask;
+            }
+        }
+
+        void place(size_t slot, std::uint64_t h, std::uint32_t n) {
+            if (ctrl_[slot] == flat_detail::kEmpty)
+                growthLeft_--;
+            ctrl_[slot] = tagOf(h);
+            slots_[slot] = n;
+        }
+
+        /**
+         * A deleted slot can be emptied if its group has an empty slot: a group only gets empty
+         * slots back by a rehash, so no probe sequence went past it since. Otherwise it is
+         * marked deleted and reclaimed by the next rehash.
+         */
+        void eraseSlot(size_t slot) {
+            const std::int8_t* group = &ctrl_[slot / flat_detail::kGroup * flat_detail::kGroup];
+            if (flat_detail::match(group, flat_detail::kEmpty)) {
+                ctrl_[slot] = flat_detail::kEmpty;
+                growthLeft_++;
+            }
+            else {
+                ctrl_[slot] = flat_detail::kDeleted;
+            }
+        }
+
+        static size_t maxLoad(size_t slots) { return slots - slots / 8; }
+
+        // rebuilds the table, twice as large unless deleted slots take most of it
+        void rehash(size_t slots) {
+            ctrl_.assign(slots, flat_detail::kEmpty);
+            slots_.assign(slots, flat_detail::kNone);
+            growthLeft_ = maxLoad(slots);
+            for (std::uint32_t n = head_; n != flat_detail::kNone; n = nodes_[n].next) {
+                std::uint64_t h = hashOf(nodes_[n].key);
+                place(freeSlot(h), h, n);
+            }
+        }
+
+        void unlink(std::uint32_t n) {
+            Node& node = nodes_[n];
+            if (node.prev != flat_detail::kNone) nodes_[node.prev].next = node.next; else head_ = node.next;
+            if (node.next != flat_detail::kNone) nodes_[node.next].prev = node.prev; else tail_ = node.prev;
+        }
+
+        void pushFront(std::uint32_t n) {
+            nodes_[n].prev = flat_detail::kNone;
+            nodes_[n].next = head_;
+            if (head_ != flat_detail::kNone) nodes_[head_].prev = n; else tail_ = n;
+            head_ = n;
+        }
+
+        void touch(std::uint32_t n) {
+            if (n == head_)
+                return;
+            unlink(n);
+            pushFront(n);
+        }
+
+        /**
+         * unlinks the node of slot and puts it on the free list, a copy is kept in removed for
+         * the remove callback, which runs once the lock is released
+         */
+        void erase(size_t slot, std::vector<Node>& removed) {
+            std::uint32_t n = slots_[slot];
+            eraseSlot(slot);
+            unlink(n);
+            cacheSize_ -= nodes_[n].size;
+            count_--;
+            if (removeCallback_)
+                removed.push_back(nodes_[n]);
+            nodes_[n].next = free_;
+            free_ = n;
+        }
+
+        /**
+         * hands the removed entries to the remove callback, must be called without lock_ held
+         * (see LRUCache::notify())
+         */
+        void notify(std::vector<Node>& removed) {
+            bool failed = false;
+            for (auto& n : removed) {
+                try{
+                    removeCallback_(removeClientContext_, std::move(n));
+                }
+                catch(...){
+                    failed = true;
+                }
+            }
+            if (failed)
+                throw CallBackFailed();
+        }
+
+    public:
+        /**
+         * the maxSize is the soft limit of keys and (maxSize + elasticity) is the hard limit
+         * the cache is allowed to grow till (maxSize + elasticity) and is pruned back to maxSize keys
+         * set maxSize = 0 for an unbounded cache
+         * expectedEntries is the number of entries the arrays are sized for (default: maxSize + elasticity)
+         * removeCallback runs after the lock is released, see LRUCache
+         */
+        explicit FlatLRUCache(size_t maxSize = 64, size_t elasticity = 10, Callback insertCallback = nullptr,
+        RemoveCallback removeCallback = nullptr,void * insertClientContext = nullptr,void * removeClientContext = nullptr,
+        size_t expectedEntries = 0)
+        : head_(flat_detail::kNone), tail_(flat_detail::kNone), free_(flat_detail::kNone), count_(0),
+          maxSize_(maxSize), elasticity_(elasticity), cacheSize_(0),
+          removeCallback_(removeCallback), insertCallback_(insertCallback),
+          insertClientContext_(insertClientContext),removeClientContext_(removeClientContext){
+            size_t entries = expectedEntries ? expectedEntries : maxSize + elasticity;
+            size_t n = flat_detail::kGroup;
+            while (maxLoad(n) <= entries)
+                n <<= 1;
+            // the cache holds one entry more than maxSize + elasticity before it is pruned
+            nodes_.reserve(entries + 1);
+            rehash(n);
+        }
+
+        virtual ~FlatLRUCache() = default;
+
+        void updateSize(size_t maxSize, size_t elasticity){
+            std::vector<Node> evicted;
+            {
+                Guard g(lock_);
+                maxSize_ = maxSize;
+                elasticity_ = elasticity;
+                prune(evicted);
+            }
+            notify(evicted);
+        }
+
+        size_t size() const {
+            SharedGuard g(lock_);
+            return cacheSize_;
+        }
+
+        size_t freeSize() const {
+            SharedGuard g(lock_);
+            return maxSize_ + elasticity_ - cacheSize_;
+        }
+
+        bool empty() const {
+            SharedGuard g(lock_);
+            return count_ == 0;
+        }
+
+        /**
+         * the bytes held by the entry array and the table
+         */
+        size_t residentBytes() const {
+            SharedGuard g(lock_);
+            return sizeof(*this) + nodes_.capacity() * sizeof(Node) +
+                   ctrl_.capacity() * sizeof(std::int8_t) + slots_.capacity() * sizeof(std::uint32_t);
+        }
+
+        void clear() {
+            Guard g(lock_);
+            nodes_.clear();
+            head_ = tail_ = free_ = flat_detail::kNone;
+            count_ = 0;
+            cacheSize_ = 0;
+            rehash(ctrl_.size());
+        }
+
+        void insert(const Key& k, const Value& v,const size_t & s,void * insertClientContext) {
+            std::vector<Node> evicted;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    insertLocked(k, v, s, insertClientContext, evicted);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        void insert(const Key& k, const Value& v,const size_t & s) {
+            insert(k,v,s,nullptr);
+        }
+        /**
+         * This function throws
+         * The const reference returned here is only
+         * guaranteed to be valid till the next insert/delete
+         */
+        template <class K = Key>
+        const Value& get(const K& k) {
+            Guard g(lock_);
+            size_t i = find(k, hashOf(k));
+            if (i == flat_detail::kNoSlot) {
+                throw KeyNotFound();
+            }
+            touch(slots_[i]);
+            return nodes_[slots_[i]].value;
+        }
+        /**
+         * This function throws
+         * returns a copy of the stored object (if found)
+         */
+        template <class K = Key>
+        Value getCopy(const K& k) {
+            return get(k);
+        }
+
+        /**
+         * Try to get the value for k and copy it to v and return true
+         */
+        template <class K = Key>
+        bool getCopy(const K& k, Value& v) {
+            Guard g(lock_);
+            size_t i = find(k, hashOf(k));
+            if (i == flat_detail::kNoSlot) {
+                return false;
+            }
+            touch(slots_[i]);
+            v = nodes_[slots_[i]].value;
+            return true;
+        }
+        /**
+         * getCopy() without promoting the entry, under the shared lock for a reader-writer Lock
+         */
+        template <class K = Key>
+        bool peek(const K& k, Value& v) const {
+            SharedGuard g(lock_);
+            size_t i = find(k, hashOf(k));
+            if (i == flat_detail::kNoSlot) {
+                return false;
+            }
+            v = nodes_[slots_[i]].value;
+            return true;
+        }
+        /**
+         * This function throws CallBackFailed if the remove callback fails, the entry is removed anyway
+         */
+        template <class K = Key>
+        bool remove(const K& k) {
+            std::vector<Node> removed;
+            {
+                Guard g(lock_);
+                size_t i = find(k, hashOf(k));
+                if (i == flat_detail::kNoSlot) {
+                    return false;
+                }
+                erase(i, removed);
+            }
+            notify(removed);
+            return true;
+        }
+        template <class K = Key>
+        bool contains(const K& k) const {
+            SharedGuard g(lock_);
+            return find(k, hashOf(k)) != flat_detail::kNoSlot;
+        }
+        /**
+         * The batch operations take the lock once for the whole range and prefetch the groups of
+         * kBatch keys before probing them, as in IntrusiveLRUCache (key ranges must be forward
+         * iterators).
+         *
+         * writes a std::pair(key, value) to out for every key of [first, last) found, promoting
+         * it as get() does; returns out past the last pair written
+         */
+        template <class KeyIt, class OutIt>
+        OutIt getMany(KeyIt first, KeyIt last, OutIt out) {
+            std::uint64_t hashes[kBatch];
+            Guard g(lock_);
+            while (first != last) {
+                size_t n = 0;
+                for (KeyIt it = first; it != last && n < kBatch; ++it, ++n) {
+                    hashes[n] = hashOf(*it);
+                    prefetch(hashes[n]);
+                }
+                for (size_t i = 0; i < n; ++i, ++first) {
+                    size_t slot = find(*first, hashes[i]);
+                    if (slot == flat_detail::kNoSlot)
+                        continue;
+                    const Node& node = nodes_[slots_[slot]];
+                    touch(slots_[slot]);
+                    *out++ = std::make_pair(node.key, node.value);
+                }
+            }
+            return out;
+        }
+
+        /**
+         * inserts every (key, value, size) tuple of [first, last) in order
+         * This function throws TooLargeSize for an entry that doesn't fit, the entries before
+         * it stay inserted
+         */
+        template <class It>
+        void insertMany(It first, It last) {
+            std::vector<Node> evicted;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    for (; first != last; ++first) {
+                        const auto& e = *first;
+                        insertLocked(std::get<0>(e), std::get<1>(e), std::get<2>(e), nullptr, evicted);
+                    }
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /**
+         * removes every key of [first, last), returns the number of keys removed
+         */
+        template <class KeyIt>
+        size_t removeMany(KeyIt first, KeyIt last) {
+            std::uint64_t hashes[kBatch];
+            size_t count = 0;
+            std::vector<Node> removed;
+            {
+                Guard g(lock_);
+                while (first != last) {
+                    size_t n = 0;
+                    for (KeyIt it = first; it != last && n < kBatch; ++it, ++n) {
+                        hashes[n] = hashOf(*it);
+                        prefetch(hashes[n]);
+                    }
+                    for (size_t i = 0; i < n; ++i, ++first) {
+                        size_t slot = find(*first, hashes[i]);
+                        if (slot == flat_detail::kNoSlot)
+                            continue;
+                        erase(slot, removed);
+                        count++;
+                    }
+                }
+            }
+            notify(removed);
+            return count;
+        }
+
+        size_t getMaxSize() const { return maxSize_; }
+        size_t getElasticity() const { return elasticity_; }
+        size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+
+        /**
+         * walks the entries in LRU order, most recently used first
+         */
+        template <typename F>
+        void cwalk(F& f) const {
+            SharedGuard g(lock_);
+            for (std::uint32_t n = head_; n != flat_detail::kNone; n = nodes_[n].next)
+                f(nodes_[n]);
+        }
+
+    protected:
+        // must be called with lock_ held, copies of the nodes pruned are added to evicted
+        void insertLocked(const Key& k, const Value& v,const size_t & s,void * insertClientContext,
+        std::vector<Node>& evicted) {
+            if (s > std::numeric_limits<std::uint32_t>::max())
+                throw TooLargeSize();
+            std::uint64_t h = hashOf(k);
+            size_t i = find(k, h);
+            std::uint32_t n;
+
+            if (i != flat_detail::kNoSlot) {
+                n = slots_[i];
+                Node& node = nodes_[n];
+                if(s > node.size && s - node.size > maxSize_ + elasticity_ - cacheSize_)
+                    throw TooLargeSize();
+                cacheSize_ = cacheSize_ - node.size + s;
+                node.size = static_cast<std::uint32_t>(s);
+                node.value = v;
+                touch(n);
+            }
+            else{
+                if(s > maxSize_ + elasticity_)
+                    throw TooLargeSize();
+                if (free_ == flat_detail::kNone && nodes_.size() >= flat_detail::kNone)
+                    throw std::length_error("FlatLRUCache: too many entries");
+                if (growthLeft_ == 0)
+                    rehash(count_ * 2 < maxLoad(ctrl_.size()) ? ctrl_.size() : ctrl_.size() * 2);
+                if (free_ != flat_detail::kNone) {
+                    n = free_;
+                    free_ = nodes_[n].next;
+                }
+                else {
+                    n = static_cast<std::uint32_t>(nodes_.size());
+                    nodes_.emplace_back();
+                }
+                Node& node = nodes_[n];
+                node.key = k;
+                node.value = v;
+                node.size = static_cast<std::uint32_t>(s);
+                place(freeSlot(h), h, n);
+                pushFront(n);
+                count_++;
+                cacheSize_+=s;
+            }
+            // prune() runs after the callback, also if it throws
+            PruneOnExit<FlatLRUCache, std::vector<Node>> pruner(*this, evicted);
+            if(insertCallback_){
+                try{
+                    // if no specific context is provided of the insert use global context
+                    if(!insertClientContext)
+                        insertCallback_(insertClientContext_,nodes_[n]);
+                    else
+                        insertCallback_(insertClientContext,nodes_[n]);
+                }
+                catch(...){
+                    throw CallBackFailed();
+                }
+            }
+        }
+
+        size_t prune(std::vector<Node>& evicted) {
+            size_t maxAllowed = maxSize_ + elasticity_;
+            if (maxSize_ == 0 || cacheSize_ < maxAllowed) {
+                return 0;
+            }
+            size_t removedSize = 0;
+            while (cacheSize_ > maxSize_) {
+                //Remove from the LRU, the callback runs once the lock is released
+                removedSize+=nodes_[tail_].size;
+                erase(slotOf(tail_), evicted);
+            }
+            return removedSize;
+        }
+    };
+
+    /**
+     * FlatLRUCache when Key and Value are trivially copyable and small, LRUCache otherwise
+     */
+    template <class Key, class Value, class Lock = NullLock>
+    using CompactLRUCache = typename std::conditional<
+        std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value &&
+        sizeof(Key) <= 16 && sizeof(Value) <= 16,
+        FlatLRUCache<Key, Value, Lock>, LRUCache<Key, Value, Lock>>::type;
+}
+#endif // FLAT_LRU_CACHE_HPP
@@ -0,0 +1,574 @@
+/* @file IntrusiveLRUCache.hpp*/
+#ifndef INTRUSIVE_LRU_CACHE_HPP
+#define INTRUSIVE_LRU_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "LRUCache.hpp"
+#include "../memoryPool/memPool.h"
+
+namespace lru {
+
+    /**
+     * The IntrusiveLRUCache class templated by
+     *        Key - key type
+     *        Value - value type
+     *        Lock - a lock type like std::mutex (default: NullLock = no synchronization)
+     *        Hash - hash of the key
+     *        KeyEqual - equality of the key
+     *
+     * Same interface and size semantics as LRUCache, with a different storage layout:
+     * every entry is a single node (key, value, size, hash and the prev/next links of the LRU list)
+     * allocated from a MemPool, and the hash table is an open addressing array of (hash, node)
+     * slots with linear probing. An insert costs one pool allocation instead of a list node plus
+     * a map node from the system allocator, and a lookup compares hashes inside the slot array
+     * and only dereferences the node it matches.
+     */
+    template <class Key, class Value, class Lock = NullLock,
+    class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class IntrusiveLRUCache {
+
+    public:
+        /**
+         * lru cache entry, linked in the LRU list (prev is towards the most recent entry)
+         */
+        struct Node {
+            Key key;
+            Value value;
+            size_t size;
+            size_t hash;
+            Node* prev;
+            Node* next;
+            Node(const Key& k, const Value& v, size_t s, size_t h)
+            : key(k), value(v), size(s), hash(h), prev(nullptr), next(nullptr) {}
+        };
+        typedef Node node_type;
+        typedef Lock lock_type;
+        using Guard = std::lock_guard<lock_type>;
+        using SharedGuard = ReadGuard<lock_type>;
+        using Callback = std::function<void(void *,const node_type&)>;
+        using RemoveCallback = std::function<void(void *,node_type&&)>;
+        using Executor = std::function<void(std::function<void()>)>;
+    private:
+        // Dissallow copying.
+        IntrusiveLRUCache(const IntrusiveLRUCache&) = delete;
+        IntrusiveLRUCache& operator=(const IntrusiveLRUCache&) = delete;
+        template <class, class> friend class PruneOnExit;
+
+        struct Slot {
+            size_t hash;
+            Node* node; // nullptr for an empty slot
+        };
+
+        // pool units are rounded up so that every node in the pool block stays aligned
+        static constexpr size_t kUnitSize =
+            (sizeof(Node) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+        static_assert(alignof(Node) <= alignof(std::max_align_t), "over-aligned keys or values are not supported");
+
+        mutable Lock lock_;
+        MemPool pool_;
+        std::vector<Slot> slots_;
+        size_t count_;
+        Node* head_; // most recently used
+        Node* tail_; // least recently used
+        Hash hash_;
+        KeyEqual equal_;
+        size_t maxSize_;
+        size_t elasticity_;
+        size_t cacheSize_;
+        RemoveCallback removeCallback_;
+        Callback insertCallback_;
+        Executor removeExecutor_;
+        void* insertClientContext_;
+        void* removeClientContext_;
+
+        size_t mask() const { return slots_.size() - 1; }
+
+        // returns the slot holding k or the empty slot ending its probe sequence
+        template <class K>
+        size_t probe(const K& k, size_t h) const {
+            size_t i = h & mask();
+            while (slots_[i].node) {
+                if (slots_[i].hash == h && equal_(slots_[i].node->key, k))
+                    return i;
+                i = (i + 1) & mask();
+            }
+            return i;
+        }
+
+        // keys hashed and prefetched ahead of their probes in the batch operations
+        static constexpr size_t kBatch = 16;
+
+        void prefetch(size_t h) const {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(&slots_[h & mask()]);
+#else
+            (void)h;
+#endif
+        }
+
+        template <class K>
+        Node* find(const K& k) const {
+            return slots_[probe(k, hash_(k))].node;
+        }
+
+        // the slot of a node in the table, found by address without comparing keys
+        size_t slotOf(const Node* n) const {
+            size_t i = n->hash & mask();
+            while (slots_[i].node != n)
+                i = (i + 1) & mask();
+            return i;
+        }
+
+        void grow() {
+            std::vector<Slot> old(slots_.size() * 2, Slot{0, nullptr});
+            old.swap(slots_);
+            for (const Slot& s : old) {
+                if (!s.node)
+                    continue;
+                size_t i = s.hash & mask();
+                while (slots_[i].node)
+                    i = (i + 1) & mask();
+                slots_[i] = s;
+            }
+        }
+
+        // backward shift deletion, keeps probe sequences intact without tombstones
+        void eraseSlot(size_t i) {
+            size_t j = i;
+            for (;;) {
+                j = (j + 1) & mask();
+                if (!slots_[j].node)
+                    break;
+                size_t home = slots_[j].hash & mask();
+                // move j back into the hole unless its home lies cyclically in (i, j]
+                if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j))
+                    continue;
+                slots_[i] = slots_[j];
+                i = j;
+            }
+            slots_[i].node = nullptr;
+        }
+
+        void unlink(Node* n) {
+            if (n->prev) n->prev->next = n->next; else head_ = n->next;
+            if (n->next) n->next->prev = n->prev; else tail_ = n->prev;
+            n->prev = n->next = nullptr;
+        }
+
+        void pushFront(Node* n) {
+            n->prev = nullptr;
+            n->next = head_;
+            if (head_) head_->prev = n; else tail_ = n;
+            head_ = n;
+        }
+
+        void touch(Node* n) {
+            if (n == head_)
+                return;
+            unlink(n);
+            pushFront(n);
+        }
+
+        void destroy(Node* n) {
+            n->~Node();
+            pool_.Free(n);
+        }
+
+        /**
+         * unlinks n and pushes it on the removed chain (linked through next), the slot must be the
+         * one holding n. The nodes are freed by release() once their callbacks ran.
+         */
+        void erase(size_t slot, Node* n, Node*& removed) {
+            eraseSlot(slot);
+            unlink(n);
+            cacheSize_ -= n->size;
+            count_--;
+            n->next = removed;
+            removed = n;
+        }
+
+        void release(Node* removed) {
+            Guard g(lock_);
+            while (removed) {
+                Node* next = removed->next;
+                destroy(removed);
+                removed = next;
+            }
+        }
+
+        /**
+         * hands the removed nodes to the remove callback and frees them, must be called without
+         * lock_ held (see LRUCache::notify())
+         */
+        void notify(Node* removed) {
+            if (!removed)
+                return;
+            if (removeCallback_ && removeExecutor_) {
+                removeExecutor_([this, removed] () {
+                    for (Node* n = removed; n; n = n->next) {
+                        try {
+                            removeCallback_(removeClientContext_, std::move(*n));
+                        }
+                        catch (...) {
+                        }
+                    }
+                    release(removed);
+                });
+                return;
+            }
+            bool failed = false;
+            if (removeCallback_) {
+                for (Node* n = removed; n; n = n->next) {
+                    try{
+                        removeCallback_(removeClientContext_, std::move(*n));
+                    }
+                    catch(...){
+                        failed = true;
+                    }
+                }
+            }
+            release(removed);
+            if (failed)
+                throw CallBackFailed();
+        }
+
+    public:
+        /**
+         * the maxSize is the soft limit of keys and (maxSize + elasticity) is the hard limit
+         * the cache is allowed to grow till (maxSize + elasticity) and is pruned back to maxSize keys
+         * set maxSize = 0 for an unbounded cache
+         * expectedEntries is the number of nodes preallocated in the pool (default: maxSize + elasticity)
+         * removeCallback runs after the lock is released, see LRUCache; with removeExecutor the
+         * cache must outlive the tasks it passed on
+         */
+        explicit IntrusiveLRUCache(size_t maxSize = 64, size_t elasticity = 10, Callback insertCallback = nullptr,
+        RemoveCallback removeCallback = nullptr,void * insertClientContext = nullptr,void * removeClientContext = nullptr,
+        size_t expectedEntries = 0, Executor removeExecutor = nullptr)
+        : pool_(expectedEntries ? expectedEntries : std::max<size_t>(maxSize + elasticity, 16), kUnitSize),
+          count_(0), head_(nullptr), tail_(nullptr),
+          maxSize_(maxSize), elasticity_(elasticity), cacheSize_(0),
+          removeCallback_(removeCallback), insertCallback_(insertCallback), removeExecutor_(removeExecutor),
+          insertClientContext_(insertClientContext),removeClientContext_(removeClientContext){
+            size_t n = 16;
+            size_t entries = expectedEntries ? expectedEntries : maxSize + elasticity;
+            while (n * 3 < entries * 4)
+                n <<= 1;
+            slots_.assign(n, Slot{0, nullptr});
+        }
+
+        virtual ~IntrusiveLRUCache() {
+            for (Node* n = head_; n; ) {
+                Node* next = n->next;
+                destroy(n);
+                n = next;
+            }
+        }
+
+        void updateSize(size_t maxSize, size_t elasticity){
+            Node* evicted = nullptr;
+            {
+                Guard g(lock_);
+                maxSize_ = maxSize;
+                elasticity_ = elasticity;
+                prune(evicted);
+            }
+            notify(evicted);
+        }
+
+        size_t size() const {
+            SharedGuard g(lock_);
+            return cacheSize_;
+        }
+
+        size_t freeSize() const {
+            SharedGuard g(lock_);
+            return maxSize_ + elasticity_ - cacheSize_;
+        }
+
+        bool empty() const {
+            SharedGuard g(lock_);
+            return count_ == 0;
+        }
+
+        void clear() {
+            Guard g(lock_);
+            for (Node* n = head_; n; ) {
+                Node* next = n->next;
+                destroy(n);
+                n = next;
+            }
+            head_ = tail_ = nullptr;
+            for (Slot& s : slots_)
+                s.node = nullptr;
+            count_ = 0;
+            cacheSize_ = 0;
+        }
+
+        void insert(const Key& k, const Value& v,const size_t & s,void * insertClientContext) {
+            Node* evicted = nullptr;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    insertLocked(k, v, s, insertClientContext, evicted);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        void insert(const Key& k, const Value& v,const size_t & s) {
+            insert(k,v,s,nullptr);
+        }
+        /**
+         * The lookups below take any key type K that Hash and KeyEqual accept, with StringHash
+         * and StringEqual a std::string_view, const char* or Prehashed key is looked up without
+         * building a std::string, and a Prehashed key is not hashed again.
+         *
+         * This function throws
+         * The const reference returned here is only
+         * guaranteed to be valid till the next insert/delete
+         */
+        template <class K = Key>
+        const Value& get(const K& k) {
+            Guard g(lock_);
+            Node* n = find(k);
+            if (!n) {
+                throw KeyNotFound();
+            }
+            touch(n);
+            return n->value;
+        }
+        /**
+         * This function throws
+         * returns a copy of the stored object (if found)
+         */
+        template <class K = Key>
+        Value getCopy(const K& k) {
+            return get(k);
+        }
+
+        /**
+         * Try to get the value for k and copy it to v and return true
+         */
+        template <class K = Key>
+        bool getCopy(const K& k, Value& v) {
+            Guard g(lock_);
+            Node* n = find(k);
+            if (!n) {
+                return false;
+            }
+            touch(n);
+            v = n->value;
+            return true;
+        }
+        /**
+         * getCopy() without promoting the entry, under the shared lock for a reader-writer Lock
+         */
+        template <class K = Key>
+        bool peek(const K& k, Value& v) const {
+            SharedGuard g(lock_);
+            const Node* n = find(k);
+            if (!n) {
+                return false;
+            }
+            v = n->value;
+            return true;
+        }
+        /**
+         * This function throws CallBackFailed if the remove callback fails, the entry is removed anyway
+         */
+        template <class K = Key>
+        bool remove(const K& k) {
+            Node* removed = nullptr;
+            {
+                Guard g(lock_);
+                size_t i = probe(k, hash_(k));
+                Node* n = slots_[i].node;
+                if (!n) {
+                    return false;
+                }
+                erase(i, n, removed);
+            }
+            notify(removed);
+            return true;
+        }
+        template <class K = Key>
+        bool contains(const K& k) const {
+            SharedGuard g(lock_);
+            return find(k) != nullptr;
+        }
+        /**
+         * The batch operations take the lock once for the whole range (key ranges must be forward
+         * iterators since they are walked twice). Keys are hashed in groups
+         * of kBatch and their home slots prefetched before probing, so the cache misses of
+         * a group overlap instead of being paid one key after the other.
+         *
+         * writes a std::pair(key, value) to out for every key of [first, last) found, promoting
+         * it as get() does; returns out past the last pair written
+         */
+        template <class KeyIt, class OutIt>
+        OutIt getMany(KeyIt first, KeyIt last, OutIt out) {
+            size_t hashes[kBatch];
+            Guard g(lock_);
+            while (first != last) {
+                size_t n = 0;
+                for (KeyIt it = first; it != last && n < kBatch; ++it, ++n) {
+                    hashes[n] = hash_(*it);
+                    prefetch(hashes[n]);
+                }
+                for (size_t i = 0; i < n; ++i, ++first) {
+                    Node* node = slots_[probe(*first, hashes[i])].node;
+                    if (!node)
+                        continue;
+                    touch(node);
+                    *out++ = std::make_pair(node->key, node->value);
+                }
+            }
+            return out;
+        }
+
+        /**
+         * inserts every (key, value, size) tuple of [first, last) in order
+         * This function throws TooLargeSize for an entry that doesn't fit, the entries before
+         * it stay inserted
+         */
+        template <class It>
+        void insertMany(It first, It last) {
+            Node* evicted = nullptr;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    for (; first != last; ++first) {
+                        const auto& e = *first;
+                        insertLocked(std::get<0>(e), std::get<1>(e), std::get<2>(e), nullptr, evicted);
+                    }
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /**
+         * removes every key of [first, last), returns the number of keys removed
+         */
+        template <class KeyIt>
+        size_t removeMany(KeyIt first, KeyIt last) {
+            size_t hashes[kBatch];
+            size_t count = 0;
+            Node* removed = nullptr;
+            {
+                Guard g(lock_);
+                while (first != last) {
+                    size_t n = 0;
+                    for (KeyIt it = first; it != last && n < kBatch; ++it, ++n) {
+                        hashes[n] = hash_(*it);
+                        prefetch(hashes[n]);
+                    }
+                    for (size_t i = 0; i < n; ++i, ++first) {
+                        size_t slot = probe(*first, hashes[i]);
+                        Node* node = slots_[slot].node;
+                        if (!node)
+                            continue;
+                        erase(slot, node, removed);
+                        count++;
+                    }
+                }
+            }
+            notify(removed);
+            return count;
+        }
+
+        size_t getMaxSize() const { return maxSize_; }
+        size_t getElasticity() const { return elasticity_; }
+        size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+
+        /**
+         * walks the entries in LRU order, most recently used first
+         */
+        template <typename F>
+        void cwalk(F& f) const {
+            SharedGuard g(lock_);
+            for (const Node* n = head_; n; n = n->next)
+                f(*n);
+        }
+
+    protected:
+        // must be called with lock_ held, the nodes pruned are pushed on evicted
+        void insertLocked(const Key& k, const Value& v,const size_t & s,void * insertClientContext,
+        Node*& evicted) {
+            size_t h = hash_(k);
+            size_t i = probe(k, h);
+            Node* n = slots_[i].node;
+
+            if (n) {
+                if(s > n->size && s - n->size > maxSize_ + elasticity_ - cacheSize_)
+                    throw TooLargeSize();
+                cacheSize_ = cacheSize_ - n->size + s;
+                n->size = s;
+                n->value = v;
+                touch(n);
+            }
+            else{
+                if(s > maxSize_ + elasticity_)
+                    throw TooLargeSize();
+                n = new (pool_.Alloc(sizeof(Node))) Node(k, v, s, h);
+                slots_[i] = Slot{h, n};
+                pushFront(n);
+                count_++;
+                cacheSize_+=s;
+                if (count_ * 4 > slots_.size() * 3)
+                    grow();
+            }
+            // prune() runs after the callback, also if it throws
+            PruneOnExit<IntrusiveLRUCache, Node*> pruner(*this, evicted);
+            if(insertCallback_){
+                try{
+                    // if no specific context is provided of the insert use global context
+                    if(!insertClientContext)
+                        insertCallback_(insertClientContext_,*n);
+                    else
+                        insertCallback_(insertClientContext,*n);
+                }
+                catch(...){
+                    throw CallBackFailed();
+                }
+            }
+        }
+
+        size_t prune(Node*& evicted) {
+            size_t maxAllowed = maxSize_ + elasticity_;
+            if (maxSize_ == 0 || cacheSize_ < maxAllowed) {
+                return 0;
+            }
+            size_t removedSize = 0;
+            while (cacheSize_ > maxSize_) {
+                Node* victim = tail_;
+                //Remove from the LRU, the callback runs once the lock is released
+                removedSize+=victim->size;
+                erase(slotOf(victim), victim, evicted);
+            }
+            return removedSize;
+        }
+    };
+}
+#endif // INTRUSIVE_LRU_CACHE_HPP
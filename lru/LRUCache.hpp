@@ -3,12 +3,27 @@
 #define LRU_CACHE_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 namespace lru {
 
@@ -46,6 +61,32 @@ namespace lru {
         CallBackFailed() : std::invalid_argument("callback_provided_to_lru_failed") {}
     };
 
+    /**
+     * the bookkeeping bits an eviction policy keeps in every entry
+     * They are read and written atomically (relaxed), so a policy that only sets a bit on a hit
+     * can do it under the shared lock while other readers do the same (see SharedTouch).
+     */
+    class PolicyFlags {
+        std::atomic<std::uint8_t> bits_;
+    public:
+        PolicyFlags(std::uint8_t bits = 0) : bits_(bits) {}
+        PolicyFlags(const PolicyFlags& o) : bits_(static_cast<std::uint8_t>(o)) {}
+        PolicyFlags& operator=(const PolicyFlags& o) { return *this = static_cast<std::uint8_t>(o); }
+        PolicyFlags& operator=(std::uint8_t bits) {
+            bits_.store(bits, std::memory_order_relaxed);
+            return *this;
+        }
+        operator std::uint8_t() const { return bits_.load(std::memory_order_relaxed); }
+        PolicyFlags& operator|=(std::uint8_t bits) {
+            bits_.fetch_or(bits, std::memory_order_relaxed);
+            return *this;
+        }
+        PolicyFlags& operator&=(std::uint8_t bits) {
+            bits_.fetch_and(bits, std::memory_order_relaxed);
+            return *this;
+        }
+    };
+
     /**
      * lru cache entry teemplate
      */
@@ -55,7 +96,445 @@ namespace lru {
         K key;
         V value;
         size_t size;
-        KeyValuePair(const K& k, const V& v, const size_t& s ) : key(k), value(v), size(s) {}
+        // bookkeeping bits owned by the eviction policy (reference bit etc.)
+        PolicyFlags flags;
+        // promotion clock of the cache when the entry was last promoted (see Promotion)
+        std::uint32_t stamp;
+        template <typename KK, typename VV>
+        KeyValuePair(KK&& k, VV&& v, const size_t& s )
+        : key(std::forward<KK>(k)), value(std::forward<VV>(v)), size(s), flags(0), stamp(0) {}
+        /**
+         * constructs the value in place from args
+         */
+        template <typename KK, typename... Args>
+        KeyValuePair(std::piecewise_construct_t, KK&& k, const size_t& s, Args&&... args)
+        : key(std::forward<KK>(k)), value(std::forward<Args>(args)...), size(s), flags(0), stamp(0) {}
+    };
+
+    /**
+     * the guard of read only operations: a shared lock for lock types with lock_shared()
+     * (std::shared_mutex, std::shared_timed_mutex), an exclusive lock for the others
+     */
+    template <class Lock, class = void>
+    class ReadGuard {
+        Lock& lock_;
+    public:
+        static constexpr bool shared = false;
+        explicit ReadGuard(Lock& l) : lock_(l) { lock_.lock(); }
+        ~ReadGuard() { lock_.unlock(); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    template <class Lock>
+    class ReadGuard<Lock, decltype(std::declval<Lock&>().lock_shared(), void())> {
+        Lock& lock_;
+    public:
+        static constexpr bool shared = true;
+        explicit ReadGuard(Lock& l) : lock_(l) { lock_.lock_shared(); }
+        ~ReadGuard() { lock_.unlock_shared(); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    /**
+     * prunes a cache when leaving the scope of its insert, on every path: created ahead of the
+     * insert callback, it keeps the cache within maxSize + elasticity when the callback throws.
+     * Evicted is the container the cache collects the pruned entries in.
+     */
+    template <class Cache, class Evicted>
+    class PruneOnExit {
+        Cache& cache_;
+        Evicted& evicted_;
+    public:
+        PruneOnExit(Cache& cache, Evicted& evicted) : cache_(cache), evicted_(evicted) {}
+        ~PruneOnExit() { cache_.prune(evicted_); }
+        PruneOnExit(const PruneOnExit&) = delete;
+        PruneOnExit& operator=(const PruneOnExit&) = delete;
+    };
+
+    /**
+     * when a hit in get() promotes the entry in the order of the eviction policy
+     * Promoting needs the exclusive lock, skipping most promotions lets hits run under a shared
+     * lock when the cache has a reader-writer Lock, at the price of a coarser recency order.
+     * Policies whose hits only set a bit (CLOCK, CLOCK-Pro) promote under the shared lock.
+     */
+    enum class Promotion {
+        Always,   // every hit (default)
+        EveryNth, // every N-th hit of the cache
+        ColdHalf  // hits on entries not promoted during the last size/2 promotions or inserts
+    };
+
+    /**
+     * the map type used by default, it maps every key to its node in the list of the policy
+     */
+    template <typename K, typename V>
+    using LRUMap = std::unordered_map<K, typename std::list<KeyValuePair<K, V>>::iterator>;
+
+    /**
+     * a map from the keys of a cache to T ordered or hashed like Map, the cache map
+     * A hashed Map lends its hasher and key_equal, which keeps heterogeneous and precomputed
+     * hash lookups working, an ordered one (std::map) its key_compare.
+     */
+    template <class Map, class K, class T, class = void>
+    struct SideMap {
+        typedef std::map<K, T, typename Map::key_compare> type;
+    };
+
+    template <class Map, class K, class T>
+    struct SideMap<Map, K, T, decltype(std::declval<typename Map::hasher&>(),
+                                       std::declval<typename Map::key_equal&>(), void())> {
+        typedef std::unordered_map<K, T, typename Map::hasher, typename Map::key_equal> type;
+    };
+
+    /**
+     * bytes taken from the heap by a malloc(n), with the allocator header and 16 byte granularity
+     * of the common allocators (glibc, jemalloc size classes are close)
+     */
+    inline size_t allocBytes(size_t n) {
+        return n == 0 ? 0 : (n + sizeof(void*) + 15) / 16 * 16;
+    }
+
+    /**
+     * heapBytes(x) - bytes held on the heap by x beyond sizeof(x), used by ResidentWeigher
+     * Overloads for other types are found by argument dependent lookup, so they can be
+     * declared next to the type they measure.
+     */
+    template <class T>
+    size_t heapBytes(const T&) { return 0; }
+    inline size_t heapBytes(const std::string& s);
+    template <class T, class A>
+    size_t heapBytes(const std::vector<T, A>& v);
+    template <class T>
+    size_t heapBytes(const std::shared_ptr<T>& p);
+
+    inline size_t heapBytes(const std::string& s) {
+        // a short string lives inside the object itself
+        const char* self = reinterpret_cast<const char*>(&s);
+        if (s.data() >= self && s.data() < self + sizeof(s))
+            return 0;
+        return allocBytes(s.capacity() + 1);
+    }
+
+    template <class T, class A>
+    size_t heapBytes(const std::vector<T, A>& v) {
+        size_t bytes = allocBytes(v.capacity() * sizeof(T));
+        for (const auto& e : v)
+            bytes += heapBytes(e);
+        return bytes;
+    }
+
+    template <class T>
+    size_t heapBytes(const std::shared_ptr<T>& p) {
+        // object and control block allocated together as by std::make_shared, shared owners
+        // are counted in full by every entry
+        return p ? allocBytes(sizeof(T) + 2 * sizeof(long)) + heapBytes(*p) : 0;
+    }
+
+    /**
+     * A weigher computes the size of an entry inserted without an explicit size, for
+     * insert(k, v). Any callable size_t(const Key&, const Value&) can be used.
+     *
+     * UnitWeigher counts entries, maxSize is then the number of entries (default)
+     */
+    struct UnitWeigher {
+        template <class K, class V>
+        size_t operator()(const K&, const V&) const { return 1; }
+    };
+
+    /**
+     * weighs an entry by the memory it keeps resident in LRUCache with the default LRUMap:
+     * the list node holding the KeyValuePair, the map node with its copy of the key, a bucket
+     * of the map, and the heap memory of the key (twice) and of the value.
+     * With it maxSize is a budget in bytes.
+     */
+    struct ResidentWeigher {
+        template <class K, class V>
+        size_t operator()(const K& k, const V& v) const {
+            typedef KeyValuePair<K, V> node_type;
+            typedef typename std::list<node_type>::iterator iterator;
+            // list node: prev and next links, map node: next link and cached hash
+            return allocBytes(sizeof(node_type) + 2 * sizeof(void*))
+                + allocBytes(sizeof(std::pair<const K, iterator>) + 2 * sizeof(void*))
+                + sizeof(void*)
+                + 2 * heapBytes(k) + heapBytes(v);
+        }
+    };
+
+    /**
+     * a snapshot of the statistics of a cache
+     */
+    struct CacheStats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t inserts = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t evictedWeight = 0;
+        std::uint64_t loads = 0;
+        std::chrono::nanoseconds loadTime{0};
+        // acquisitions of the lock that had to wait, and how long they waited in total
+        std::uint64_t lockWaits = 0;
+        std::chrono::nanoseconds lockWaitTime{0};
+
+        double hitRate() const {
+            return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+        }
+
+        CacheStats& operator+=(const CacheStats& o) {
+            hits += o.hits;
+            misses += o.misses;
+            inserts += o.inserts;
+            evictions += o.evictions;
+            evictedWeight += o.evictedWeight;
+            loads += o.loads;
+            loadTime += o.loadTime;
+            lockWaits += o.lockWaits;
+            lockWaitTime += o.lockWaitTime;
+            return *this;
+        }
+    };
+
+    /**
+     * A stats policy receives the events of a cache and returns their totals from snapshot().
+     * Its methods are called concurrently under the shared lock for hits and misses.
+     * timed tells the cache whether to measure how long it waits for its lock.
+     *
+     * NullStats records nothing and costs nothing (default)
+     */
+    struct NullStats {
+        static constexpr bool timed = false;
+        void hit() {}
+        void miss() {}
+        void insert() {}
+        void evict(size_t) {}
+        void load(std::chrono::nanoseconds) {}
+        void lockWait(std::chrono::nanoseconds) {}
+        CacheStats snapshot() const { return CacheStats(); }
+    };
+
+    /**
+     * counts every event in relaxed atomic counters spread over Stripes cache line sized
+     * stripes, a thread always updates the stripe its id hashes to so that threads rarely
+     * share a line. snapshot() adds the stripes up, it is not atomic with respect to updates.
+     */
+    template <size_t Stripes = 16>
+    class ConcurrentStats {
+        static_assert(Stripes > 0, "ConcurrentStats needs at least one stripe");
+
+        struct alignas(64) Counters {
+            std::atomic<std::uint64_t> hits{0};
+            std::atomic<std::uint64_t> misses{0};
+            std::atomic<std::uint64_t> inserts{0};
+            std::atomic<std::uint64_t> evictions{0};
+            std::atomic<std::uint64_t> evictedWeight{0};
+            std::atomic<std::uint64_t> loads{0};
+            std::atomic<std::uint64_t> loadTime{0};
+            std::atomic<std::uint64_t> lockWaits{0};
+            std::atomic<std::uint64_t> lockWaitTime{0};
+        };
+        Counters stripes_[Stripes];
+
+        Counters& local() {
+            static thread_local const size_t probe =
+                std::hash<std::thread::id>()(std::this_thread::get_id());
+            return stripes_[probe % Stripes];
+        }
+
+        static void add(std::atomic<std::uint64_t>& c, std::uint64_t n) {
+            c.fetch_add(n, std::memory_order_relaxed);
+        }
+
+    public:
+        static constexpr bool timed = true;
+        void hit() { add(local().hits, 1); }
+        void miss() { add(local().misses, 1); }
+        void insert() { add(local().inserts, 1); }
+        void evict(size_t weight) {
+            Counters& c = local();
+            add(c.evictions, 1);
+            add(c.evictedWeight, weight);
+        }
+        void load(std::chrono::nanoseconds t) {
+            Counters& c = local();
+            add(c.loads, 1);
+            add(c.loadTime, static_cast<std::uint64_t>(t.count()));
+        }
+        void lockWait(std::chrono::nanoseconds t) {
+            Counters& c = local();
+            add(c.lockWaits, 1);
+            add(c.lockWaitTime, static_cast<std::uint64_t>(t.count()));
+        }
+        CacheStats snapshot() const {
+            CacheStats r;
+            for (const auto& c : stripes_) {
+                r.hits += c.hits.load(std::memory_order_relaxed);
+                r.misses += c.misses.load(std::memory_order_relaxed);
+                r.inserts += c.inserts.load(std::memory_order_relaxed);
+                r.evictions += c.evictions.load(std::memory_order_relaxed);
+                r.evictedWeight += c.evictedWeight.load(std::memory_order_relaxed);
+                r.loads += c.loads.load(std::memory_order_relaxed);
+                r.loadTime += std::chrono::nanoseconds(c.loadTime.load(std::memory_order_relaxed));
+                r.lockWaits += c.lockWaits.load(std::memory_order_relaxed);
+                r.lockWaitTime += std::chrono::nanoseconds(c.lockWaitTime.load(std::memory_order_relaxed));
+            }
+            return r;
+        }
+    };
+
+    /**
+     * wraps the lock of a cache to report the time spent waiting for it to a timed stats
+     * policy. An uncontended acquisition is a single try_lock, only a failed one reads the clock.
+     * With an untimed stats policy it forwards to Lock.
+     */
+    template <class Lock, class Stats>
+    class TimedLock {
+        typedef std::integral_constant<bool, Stats::timed> timed;
+        Lock lock_;
+        Stats* stats_;
+
+        // the try_lock path is only instantiated for a timed Stats, so Lock needs no try_lock otherwise
+        void acquire(std::true_type) {
+            if (lock_.try_lock())
+                return;
+            auto start = std::chrono::steady_clock::now();
+            lock_.lock();
+            waited(start);
+        }
+        void acquire(std::false_type) {
+            lock_.lock();
+        }
+        void acquireShared(std::true_type) {
+            if (lock_.try_lock_shared())
+                return;
+            auto start = std::chrono::steady_clock::now();
+            lock_.lock_shared();
+            waited(start);
+        }
+        void acquireShared(std::false_type) {
+            lock_.lock_shared();
+        }
+        void waited(std::chrono::steady_clock::time_point start) {
+            stats_->lockWait(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start));
+        }
+
+    public:
+        explicit TimedLock(Stats* stats) : stats_(stats) {}
+        TimedLock(const TimedLock&) = delete;
+        TimedLock& operator=(const TimedLock&) = delete;
+
+        void lock() {
+            acquire(timed());
+        }
+        void unlock() { lock_.unlock(); }
+        bool try_lock() { return lock_.try_lock(); }
+
+        // only available if Lock is a reader-writer lock, see ReadGuard
+        template <class L = Lock>
+        auto lock_shared() -> decltype(std::declval<L&>().lock_shared()) {
+            acquireShared(timed());
+        }
+        template <class L = Lock>
+        auto unlock_shared() -> decltype(std::declval<L&>().unlock_shared()) {
+            lock_.unlock_shared();
+        }
+    };
+
+#if __cplusplus >= 201703L
+    /**
+     * a string key hashed once by the caller, to look it up in several caches or repeatedly
+     * without hashing it again
+     */
+    struct Prehashed {
+        std::string_view key;
+        size_t hash;
+        explicit Prehashed(std::string_view k)
+        : key(k), hash(std::hash<std::string_view>()(k)) {}
+    };
+
+    /**
+     * transparent hash and equality for std::string keys, any of std::string, std::string_view,
+     * const char* and Prehashed can be looked up without allocating a std::string
+     */
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+        size_t operator()(const Prehashed& p) const { return p.hash; }
+    };
+
+    struct StringEqual {
+        using is_transparent = void;
+        bool operator()(std::string_view a, std::string_view b) const { return a == b; }
+        bool operator()(const Prehashed& a, std::string_view b) const { return a.key == b; }
+        bool operator()(std::string_view a, const Prehashed& b) const { return a == b.key; }
+    };
+#endif
+
+    /**
+     * An eviction policy owns the list of cache entries and decides their order.
+     * Every policy is a template on the key and value type and provides
+     *        emplace(args...) - add a new entry built from the KeyValuePair arguments, return its iterator
+     *        touch(it) - record a hit on an entry, under the exclusive lock unless the policy
+     *                declares static constexpr bool sharedTouch = true (see SharedTouch)
+     *        reweigh(it, s) - change the size of an entry
+     *        victim() - the entry to evict next
+     *        erase(it, out) / evict(it, out) - remove an entry explicitly / because it was the victim,
+     *                its node is spliced into out so the cache can hand it over after unlocking
+     *        resize(maxSize) - the soft limit of the cache, for policies that split it in regions
+     *        clear(), walk(f) - drop all entries / visit the entries in the order of the policy
+     * Iterators stay valid until the entry is erased, which lets the map point into the list.
+     *
+     * LRUPolicy is the exact least recently used order: every hit moves the entry to the front
+     * and the victim is the back of the list.
+     */
+    /**
+     * whether the touch() of Policy may run under the shared lock, concurrently with the touches
+     * of other readers: true for policies declaring sharedTouch = true, whose touch() only sets
+     * a bit in the PolicyFlags of the entry
+     */
+    template <class Policy, class = void>
+    struct SharedTouch : std::false_type {};
+
+    template <class Policy>
+    struct SharedTouch<Policy, decltype(void(Policy::sharedTouch))>
+    : std::integral_constant<bool, Policy::sharedTouch> {};
+
+    template <typename K, typename V>
+    class LRUPolicy {
+    public:
+        typedef std::list<KeyValuePair<K, V>> list_type;
+        typedef typename list_type::iterator iterator;
+    private:
+        list_type keys_;
+    public:
+        template <typename... Args>
+        iterator emplace(Args&&... args) {
+            keys_.emplace_front(std::forward<Args>(args)...);
+            return keys_.begin();
+        }
+        void touch(iterator it) {
+            keys_.splice(keys_.begin(), keys_, it);
+        }
+        void reweigh(iterator it, const size_t& s) {
+            it->size = s;
+        }
+        iterator victim() {
+            return std::prev(keys_.end());
+        }
+        void erase(iterator it, list_type& out) {
+            out.splice(out.end(), keys_, it);
+        }
+        void evict(iterator it, list_type& out) {
+            out.splice(out.end(), keys_, it);
+        }
+        void resize(size_t) {}
+        void clear() {
+            keys_.clear();
+        }
+        template <typename F>
+        void walk(F& f) const {
+            std::for_each(keys_.begin(), keys_.end(), f);
+        }
     };
 
     /**
@@ -64,13 +543,17 @@ namespace lru {
      *        Value - value type
      *        MapType - an associative container like std::unordered_map
      *        LockType - a lock type derived from the Lock class (default: NullLock = no synchronization)
+     *        Policy - the eviction policy ordering the entries (default: LRUPolicy)
+     *        Weigher - the size of the entries inserted without a size (default: UnitWeigher)
+     *        Stats - the statistics kept by the cache (default: NullStats = none, see ConcurrentStats)
      *
      * The default NullLock based template is not thread-safe, however passing a lock like Lock=std::mutex
      * will make it thread-safe
      */
     template <class Key, class Value, class Lock = NullLock,
-    class Map = std::unordered_map<
-    Key, typename std::list<KeyValuePair<Key, Value>>::iterator>>
+    class Map = LRUMap<Key, Value>,
+    template <typename, typename> class Policy = LRUPolicy,
+    class Weigher = UnitWeigher, class Stats = NullStats>
     class LRUCache {
 
     public:
@@ -78,21 +561,32 @@ namespace lru {
         typedef std::list<KeyValuePair<Key, Value>> list_type;
         typedef Map map_type;
         typedef Lock lock_type;
-        using Guard = std::lock_guard<lock_type>;
-        using Callback = std::function<void(void *,KeyValuePair<Key,Value>)>;
+        typedef Policy<Key, Value> policy_type;
+        typedef Weigher weigher_type;
+        typedef Stats stats_type;
+        using Guard = std::lock_guard<TimedLock<lock_type, Stats>>;
+        using SharedGuard = ReadGuard<TimedLock<lock_type, Stats>>;
+        using Callback = std::function<void(void *,const KeyValuePair<Key,Value>&)>;
+        // gets the removed entry as an rvalue, its value can be moved out
+        using RemoveCallback = std::function<void(void *,KeyValuePair<Key,Value>&&)>;
+        using Executor = std::function<void(std::function<void()>)>;
     private:
         // Dissallow copying.
         LRUCache(const LRUCache&) = delete;
         LRUCache& operator=(const LRUCache&) = delete;
+        template <class, class> friend class PruneOnExit;
 
-        mutable Lock lock_;
+        mutable Stats stats_;
+        mutable TimedLock<Lock, Stats> lock_;
         Map cache_;
-        list_type keys_;
+        policy_type policy_;
+        Weigher weigher_;
         size_t maxSize_;
         size_t elasticity_;
         size_t cacheSize_;
-        Callback removeCallback_;
+        RemoveCallback removeCallback_;
         Callback insertCallback_;
+        Executor removeExecutor_;
         /**
          * Below are Global contexts provided to LRU cache during time of initialization. For insert
          * operations there is a provision of providing local context during the time of each insert()
@@ -101,180 +595,658 @@ namespace lru {
          */
         void* insertClientContext_;
         void* removeClientContext_;
+        // results of the loads in flight, shared by all callers of getOrLoad() for the same key
+        typename SideMap<Map, Key, std::shared_future<Value>>::type loading_;
+        Promotion promotion_;
+        size_t promotionInterval_;
+        // hits counted for Promotion::EveryNth, incremented under the shared lock
+        std::atomic<size_t> hits_;
+        // advanced by every promotion and insert, written under the exclusive lock only
+        std::uint32_t clock_;
     public:
         /**
          * the maxSize is the soft limit of keys and (maxSize + elasticity) is the hard limit
          * the cache is allowed to grow till (maxSize + elasticity) and is pruned back to maxSize keys
          * set maxSize = 0 for an unbounded cache
+         * removeCallback runs after the lock is released, once for every entry removed by the call,
+         * on the calling thread or, if removeExecutor is set, in a task passed to removeExecutor
          */
         explicit LRUCache(size_t maxSize = 64, size_t elasticity = 10, Callback insertCallback = nullptr,
-        Callback removeCallback = nullptr,void * insertClientContext = nullptr,void * removeClientContext = nullptr )
-        : maxSize_(maxSize), elasticity_(elasticity), cacheSize_(0), 
-          removeCallback_(removeCallback), insertCallback_(insertCallback),
-          insertClientContext_(insertClientContext),removeClientContext_(removeClientContext){}
+        RemoveCallback removeCallback = nullptr,void * insertClientContext = nullptr,void * removeClientContext = nullptr,
+        Executor removeExecutor = nullptr)
+        : lock_(&stats_), maxSize_(maxSize), elasticity_(elasticity), cacheSize_(0), 
+          removeCallback_(removeCallback), insertCallback_(insertCallback), removeExecutor_(removeExecutor),
+          insertClientContext_(insertClientContext),removeClientContext_(removeClientContext),
+          promotion_(Promotion::Always), promotionInterval_(1), hits_(0), clock_(0){
+            policy_.resize(maxSize);
+        }
 
         virtual ~LRUCache() = default;
 
         void updateSize(size_t maxSize, size_t elasticity){
-            maxSize_ = maxSize;
-            elasticity_ = elasticity;
-            prune();
+            list_type evicted;
+            {
+                Guard g(lock_);
+                maxSize_ = maxSize;
+                elasticity_ = elasticity;
+                policy_.resize(maxSize);
+                prune(evicted);
+            }
+            notify(evicted);
         }
 
-        size_t size() const {
+        /**
+         * sets when get() promotes the entries it finds, n is the interval of Promotion::EveryNth
+         * meant to be called before the cache is shared between threads
+         */
+        void setPromotion(Promotion promotion, size_t n = 1) {
             Guard g(lock_);
+            promotion_ = promotion;
+            promotionInterval_ = std::max<size_t>(n, 1);
+        }
+
+        size_t size() const {
+            SharedGuard g(lock_);
             return cacheSize_;
         }
 
         size_t freeSize() const {
-            Guard g(lock_);
+            SharedGuard g(lock_);
             return maxSize_ + elasticity_ - cacheSize_;
         }
 
         bool empty() const {
-            Guard g(lock_);
+            SharedGuard g(lock_);
             return cache_.empty();
         }
         void clear() {
             Guard g(lock_);
             cache_.clear();
-            keys_.clear();
+            policy_.clear();
+            cacheSize_ = 0;
         }
         
-        void insert(const Key& k, const Value& v,const size_t & s,void * insertClientContext) {
-            Guard g(lock_);
-            const auto iter = cache_.find(k);
+        /**
+         * inserts or replaces the value of k, k and v are moved in when passed as rvalues
+         * This function throws TooLargeSize when s doesn't fit in the cache
+         */
+        template <class K = Key, class V = Value>
+        void insert(K&& k, V&& v,const size_t & s,void * insertClientContext = nullptr) {
+            emplaceImpl(true, std::forward<K>(k), s, insertClientContext, std::forward<V>(v));
+        }
 
-            if (iter != cache_.end()) {
-                size_t prev_size = iter->second->size;
-                size_t size_diff = s-prev_size;
-                if(size_diff > maxSize_ + elasticity_ - cacheSize_)
-                    throw TooLargeSize();
-                iter->second->size = s;
-                iter->second->value = v;
-                keys_.splice(keys_.begin(), keys_, iter->second);
-                cacheSize_+=size_diff;
-            }
-            else{
-                if(s > maxSize_ + elasticity_)
-                    throw TooLargeSize();
-                keys_.emplace_front(k, v, s);
-                cacheSize_+=s;
-                cache_[k] = keys_.begin();
-            }
-            prune();
-            if(insertCallback_){
-                try{
-                    // if no specific context is provided of the insert use global context
-                    if(!insertClientContext)
-                        insertCallback_(insertClientContext_,keys_.front());
-                    else
-                        insertCallback_(insertClientContext,keys_.front());
-                }
-                catch(...){
-                    throw CallBackFailed();
-                }
-            }
+        /**
+         * inserts or replaces the value of k with the size given by the Weigher
+         */
+        template <class K = Key, class V = Value>
+        void insert(K&& k, V&& v) {
+            // the weigher measures a Key and a Value, k or v of another type (a string literal)
+            // is weighed as the temporary it converts to, like the stored entry
+            size_t s = weigher_(static_cast<const Key&>(k), static_cast<const Value&>(v));
+            emplaceImpl(true, std::forward<K>(k), s, nullptr, std::forward<V>(v));
         }
 
-        void insert(const Key& k, const Value& v,const size_t & s) {
-            insert(k,v,s,nullptr);
+        /**
+         * inserts or replaces the value of k with a Value constructed in place from args
+         * returns true if k was not in the cache
+         */
+        template <class K, class... Args>
+        bool emplace(K&& k, const size_t & s, Args&&... args) {
+            return emplaceImpl(true, std::forward<K>(k), s, nullptr, std::forward<Args>(args)...);
+        }
+
+        /**
+         * constructs the value of k in place from args only if k is not in the cache yet,
+         * otherwise nothing is constructed and the entry is not promoted
+         * returns true if the value was inserted
+         */
+        template <class K, class... Args>
+        bool try_emplace(K&& k, const size_t & s, Args&&... args) {
+            return emplaceImpl(false, std::forward<K>(k), s, nullptr, std::forward<Args>(args)...);
         }
 
         /**
+         * The lookups below take any key type K the map can find: Key itself, or with a
+         * transparent hash and key equality (C++20 heterogeneous lookup, see StringHash) a
+         * std::string_view, const char* or Prehashed key without building a temporary Key.
+         *
          * This function throws
          * The const reference returned here is only
          * guaranteed to be valid till the next insert/delete
          */
-        const Value& get(const Key& k) {
-            Guard g(lock_);
-            const auto iter = cache_.find(k);
-            if (iter == cache_.end()) {
+        template <class K = Key>
+        const Value& get(const K& k) {
+            const Value* v = nullptr;
+            if (!lookup(k, [&] (const node_type& n) { v = &n.value; })) {
                 throw KeyNotFound();
             }
-            keys_.splice(keys_.begin(), keys_, iter->second);
-            return iter->second->value;
+            return *v;
         }
         /**
          * This function throws
          * returns a copy of the stored object (if found)
          */
-        Value getCopy(const Key& k) {
+        template <class K = Key>
+        Value getCopy(const K& k) {
             return get(k);
         }
 
         /**
          * Try to get the value for k and copy it to v and return true
          */
-        bool getCopy(const Key& k, Value& v) {
-            Guard g(lock_);
+        template <class K = Key>
+        bool getCopy(const K& k, Value& v) {
+            return lookup(k, [&] (const node_type& n) { v = n.value; });
+        }
+
+        /**
+         * get() without promoting the entry, under the shared lock for a reader-writer Lock,
+         * for lookups that must not change what gets evicted (monitoring, audits)
+         * This function throws
+         */
+        template <class K = Key>
+        const Value& peek(const K& k) const {
+            SharedGuard g(lock_);
             const auto iter = cache_.find(k);
             if (iter == cache_.end()) {
-                return false;
+                throw KeyNotFound();
             }
-            keys_.splice(keys_.begin(), keys_, iter->second);
-            v = iter->second->value;
-            return true;
+            return iter->second->value;
         }
-        bool remove(const Key& k) {
-            Guard g(lock_);
-            auto iter = cache_.find(k);
+
+        /**
+         * getCopy() without promoting the entry
+         */
+        template <class K = Key>
+        bool peek(const K& k, Value& v) const {
+            SharedGuard g(lock_);
+            const auto iter = cache_.find(k);
             if (iter == cache_.end()) {
                 return false;
             }
-            if(removeCallback_){
-                try{
-                    removeCallback_(removeClientContext_,*iter->second);
-                }
-                catch(...){
-                    throw CallBackFailed();
+            v = iter->second->value;
+            return true;
+        }
+        /**
+         * This function throws CallBackFailed if the remove callback fails, the entry is removed anyway
+         */
+        template <class K = Key>
+        bool remove(const K& k) {
+            list_type removed;
+            {
+                Guard g(lock_);
+                auto iter = cache_.find(k);
+                if (iter == cache_.end()) {
+                    return false;
                 }
+                size_t s = iter->second->size;
+                auto node = iter->second;
+                cache_.erase(iter);
+                policy_.erase(node, removed);
+                cacheSize_-=s;
             }
-            size_t s = iter->second->size;
-            keys_.erase(iter->second);
-            cache_.erase(iter);
-            cacheSize_-=s;
+            notify(removed);
             return true;
         }
-        bool contains(const Key& k) const {
-            Guard g(lock_);
+        template <class K = Key>
+        bool contains(const K& k) const {
+            SharedGuard g(lock_);
             return cache_.find(k) != cache_.end();
         }
         size_t getMaxSize() const { return maxSize_; }
         size_t getElasticity() const { return elasticity_; }
         size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+
+        /**
+         * the statistics recorded so far by the Stats policy
+         */
+        CacheStats stats() const {
+            return stats_.snapshot();
+        }
+
+        /**
+         * estimate of the memory held by the cache: every entry as weighed by ResidentWeigher,
+         * the bucket array of the map and the cache object itself, whatever the sizes the
+         * entries were inserted with. Walks all entries, meant for monitoring.
+         */
+        size_t residentBytes() const {
+            SharedGuard g(lock_);
+            ResidentWeigher weigh;
+            size_t bytes = sizeof(*this) + allocBytes(cache_.bucket_count() * sizeof(void*));
+            for (const auto& kv : cache_)
+                bytes += weigh(kv.second->key, kv.second->value);
+            // the buckets were counted above as they are, not as a share of every entry
+            return bytes - cache_.size() * sizeof(void*);
+        }
+
+        /**
+         * walks the entries in the order of the policy (most recently used first for LRUPolicy)
+         */
         template <typename F>
         void cwalk(F& f) const {
+            SharedGuard g(lock_);
+            policy_.walk(f);
+        }
+
+        /**
+         * The batch operations below take the lock once for a whole range of keys.
+         *
+         * looks up every key of [first, last) and writes a std::pair(key, value) to out for each
+         * one found, promoting it as get() does; returns out past the last pair written
+         */
+        template <class KeyIt, class OutIt>
+        OutIt getMany(KeyIt first, KeyIt last, OutIt out) {
             Guard g(lock_);
-            std::for_each(keys_.begin(), keys_.end(), f);
+            for (; first != last; ++first) {
+                const auto iter = cache_.find(*first);
+                if (iter == cache_.end()) {
+                    stats_.miss();
+                    continue;
+                }
+                stats_.hit();
+                if (wantsPromotion(*iter->second))
+                    promote(iter->second);
+                *out++ = std::make_pair(iter->second->key, iter->second->value);
+            }
+            return out;
+        }
+
+        /**
+         * inserts every (key, value, size) tuple of [first, last) in order, a range of
+         * std::move_iterator moves the keys and values in
+         * This function throws TooLargeSize for an entry that doesn't fit, the entries before
+         * it stay inserted
+         */
+        template <class It>
+        void insertMany(It first, It last) {
+            list_type evicted;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    for (; first != last; ++first) {
+                        auto&& e = *first;
+                        emplaceLocked(true, evicted, std::get<0>(std::forward<decltype(e)>(e)),
+                                      std::get<2>(e), nullptr, std::get<1>(std::forward<decltype(e)>(e)));
+                    }
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            // the entries evicted before a failure are still handed to the callback
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /**
+         * removes every key of [first, last), returns the number of keys removed
+         */
+        template <class KeyIt>
+        size_t removeMany(KeyIt first, KeyIt last) {
+            list_type removed;
+            {
+                Guard g(lock_);
+                for (; first != last; ++first) {
+                    auto iter = cache_.find(*first);
+                    if (iter == cache_.end())
+                        continue;
+                    cacheSize_ -= iter->second->size;
+                    auto node = iter->second;
+                    cache_.erase(iter);
+                    policy_.erase(node, removed);
+                }
+            }
+            size_t count = removed.size();
+            notify(removed);
+            return count;
+        }
+
+        /**
+         * returns the value of k, loading it with loader(k) and inserting it with size s on a miss
+         * Only one load runs per key: concurrent callers missing the same key wait for its result
+         * instead of calling their own loader. No lock is held while loading or waiting.
+         * If the loader throws, the exception is rethrown to the caller and to every waiter and
+         * nothing is cached, so the next call loads again.
+         */
+        template <class Loader>
+        Value getOrLoad(const Key& k, Loader&& loader, const size_t & s = 1) {
+            std::promise<Value> promise;
+            std::shared_future<Value> pending;
+            {
+                Guard g(lock_);
+                const auto iter = cache_.find(k);
+                if (iter != cache_.end()) {
+                    stats_.hit();
+                    if (wantsPromotion(*iter->second))
+                        promote(iter->second);
+                    return iter->second->value;
+                }
+                stats_.miss();
+                const auto l = loading_.find(k);
+                if (l != loading_.end())
+                    pending = l->second;
+                else
+                    loading_.emplace(k, promise.get_future().share());
+            }
+            if (pending.valid())
+                return pending.get();
+            return load(k, loader, s, promise);
+        }
+
+        /**
+         * asynchronous getOrLoad(): a hit returns a ready future, a miss joins the load in flight
+         * for k or starts one by passing a task to executor, typically a thread pool. The tasks
+         * use the cache, so the executor must run or drop them before the cache is destroyed.
+         * Throws std::invalid_argument if executor is empty.
+         */
+        template <class Loader>
+        std::shared_future<Value> getOrLoadAsync(const Key& k, Loader loader, Executor executor,
+        const size_t & s = 1) {
+            if (!executor)
+                throw std::invalid_argument("getOrLoadAsync_requires_an_executor");
+            auto promise = std::make_shared<std::promise<Value>>();
+            std::shared_future<Value> result = promise->get_future().share();
+            {
+                Guard g(lock_);
+                const auto iter = cache_.find(k);
+                if (iter != cache_.end()) {
+                    stats_.hit();
+                    if (wantsPromotion(*iter->second))
+                        promote(iter->second);
+                    promise->set_value(iter->second->value);
+                    return result;
+                }
+                stats_.miss();
+                const auto l = loading_.find(k);
+                if (l != loading_.end())
+                    return l->second;
+                loading_.emplace(k, result);
+            }
+            std::function<void()> task = [this, k, loader, s, promise] () mutable {
+                try {
+                    load(k, loader, s, *promise);
+                }
+                catch (...) {
+                    // already delivered through the future
+                }
+            };
+            executor(std::move(task));
+            return result;
         }
 
     protected:
-        size_t prune() {
+        // must be called with lock_ held exclusively
+        void promote(typename list_type::iterator it) {
+            policy_.touch(it);
+            it->stamp = ++clock_;
+        }
+
+        // whether a hit on n should promote it, safe under the shared lock
+        bool wantsPromotion(const node_type& n) {
+            switch (promotion_) {
+                case Promotion::EveryNth:
+                    return hits_.fetch_add(1, std::memory_order_relaxed) % promotionInterval_ == 0;
+                case Promotion::ColdHalf:
+                    // the clock wraps around, the difference of stamps stays correct
+                    return static_cast<std::uint32_t>(clock_ - n.stamp) > cache_.size() / 2;
+                default:
+                    return true;
+            }
+        }
+
+        /**
+         * finds k and calls f(node) under the lock, promoting the entry as set by setPromotion()
+         * With a reader-writer Lock, hits that don't promote only take the shared lock, and so
+         * do the hits promoted by a policy with SharedTouch. The others look the key up again
+         * under the exclusive lock.
+         * returns false if k is not cached
+         */
+        template <class K, class F>
+        bool lookup(const K& k, F&& f) {
+            if (SharedGuard::shared && (SharedTouch<policy_type>::value || promotion_ != Promotion::Always)) {
+                {
+                    SharedGuard g(lock_);
+                    const auto iter = cache_.find(k);
+                    if (iter == cache_.end()) {
+                        stats_.miss();
+                        return false;
+                    }
+                    bool touch = wantsPromotion(*iter->second);
+                    if (!touch || SharedTouch<policy_type>::value) {
+                        stats_.hit();
+                        // the stamp read by Promotion::ColdHalf isn't advanced, the clock
+                        // is only written under the exclusive lock
+                        if (touch)
+                            policy_.touch(iter->second);
+                        f(*iter->second);
+                        return true;
+                    }
+                }
+                // the hit or miss is counted by the lookup that decides, the entry may be gone
+                Guard g(lock_);
+                const auto iter = cache_.find(k);
+                if (iter == cache_.end()) {
+                    stats_.miss();
+                    return false;
+                }
+                stats_.hit();
+                promote(iter->second);
+                f(*iter->second);
+                return true;
+            }
+            Guard g(lock_);
+            const auto iter = cache_.find(k);
+            if (iter == cache_.end()) {
+                stats_.miss();
+                return false;
+            }
+            stats_.hit();
+            if (wantsPromotion(*iter->second))
+                promote(iter->second);
+            f(*iter->second);
+            return true;
+        }
+
+        // runs the loader registered in loading_ for k and publishes its result
+        template <class Loader>
+        Value load(const Key& k, Loader& loader, const size_t & s, std::promise<Value>& promise) {
+            bool registered = true;
+            bool settled = false;
+            try {
+                auto start = std::chrono::steady_clock::now();
+                Value v = loader(k);
+                stats_.load(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start));
+                list_type evicted;
+                std::exception_ptr error;
+                {
+                    Guard g(lock_);
+                    loading_.erase(k);
+                    registered = false;
+                    try {
+                        emplaceLocked(true, evicted, k, s, nullptr, v);
+                    }
+                    catch (...) {
+                        error = std::current_exception();
+                    }
+                }
+                settled = true;
+                if (error)
+                    promise.set_exception(error);
+                else
+                    promise.set_value(v);
+                // evicted holds the entries pruned before the insert failed, if it did
+                notify(evicted);
+                if (error)
+                    std::rethrow_exception(error);
+                return v;
+            }
+            catch (...) {
+                if (registered) {
+                    Guard g(lock_);
+                    loading_.erase(k);
+                }
+                if (!settled)
+                    promise.set_exception(std::current_exception());
+                throw;
+            }
+        }
+
+        // replaces a value by assignment when possible, by a constructed temporary otherwise
+        template <class V>
+        static auto assign(Value& dst, V&& v) -> decltype(dst = std::forward<V>(v), void()) {
+            dst = std::forward<V>(v);
+        }
+        template <class... Args>
+        static void assign(Value& dst, Args&&... args) {
+            dst = Value(std::forward<Args>(args)...);
+        }
+
+        template <class K, class... Args>
+        bool emplaceImpl(bool replace, K&& k, const size_t & s, void * insertClientContext, Args&&... args) {
+            list_type evicted;
+            bool inserted = false;
+            std::exception_ptr error;
+            {
+                Guard g(lock_);
+                try {
+                    inserted = emplaceLocked(replace, evicted, std::forward<K>(k), s, insertClientContext,
+                                             std::forward<Args>(args)...);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            // the entries pruned after a failing insert callback are still handed to the callback
+            notify(evicted);
+            if (error)
+                std::rethrow_exception(error);
+            return inserted;
+        }
+
+        // must be called with lock_ held, the entries pruned are spliced into evicted
+        template <class K, class... Args>
+        bool emplaceLocked(bool replace, list_type& evicted, K&& k, const size_t & s, void * insertClientContext, Args&&... args) {
+            const auto iter = cache_.find(k);
+            typename list_type::iterator node;
+
+            if (iter != cache_.end()) {
+                if (!replace)
+                    return false;
+                size_t prev_size = iter->second->size;
+                if(s > prev_size && s - prev_size > maxSize_ + elasticity_ - cacheSize_)
+                    throw TooLargeSize();
+                node = iter->second;
+                policy_.reweigh(node, s);
+                assign(node->value, std::forward<Args>(args)...);
+                promote(node);
+                cacheSize_ = cacheSize_ - prev_size + s;
+            }
+            else{
+                if(s > maxSize_ + elasticity_)
+                    throw TooLargeSize();
+                node = policy_.emplace(std::piecewise_construct, std::forward<K>(k), s, std::forward<Args>(args)...);
+                node->stamp = ++clock_;
+                cacheSize_+=s;
+                cache_.emplace(node->key, node);
+            }
+            stats_.insert();
+            // the callback runs before prune() since the policy may pick the new entry as victim,
+            // prune() still runs if it throws
+            PruneOnExit<LRUCache, list_type> pruner(*this, evicted);
+            if(insertCallback_){
+                try{
+                    // if no specific context is provided of the insert use global context
+                    if(!insertClientContext)
+                        insertCallback_(insertClientContext_,*node);
+                    else
+                        insertCallback_(insertClientContext,*node);
+                }
+                catch(...){
+                    throw CallBackFailed();
+                }
+            }
+            return true;
+        }
+
+        /**
+         * hands the removed entries to the remove callback, must be called without lock_ held
+         * A failing callback does not stop the batch, CallBackFailed is thrown after it.
+         * With an executor the batch is passed on as a single task and failures are dropped.
+         */
+        void notify(list_type& removed) {
+            if (removed.empty() || !removeCallback_)
+                return;
+            if (removeExecutor_) {
+                auto batch = std::make_shared<list_type>(std::move(removed));
+                RemoveCallback callback = removeCallback_;
+                void* context = removeClientContext_;
+                removeExecutor_([batch, callback, context] () {
+                    for (auto& node : *batch) {
+                        try {
+                            callback(context, std::move(node));
+                        }
+                        catch (...) {
+                        }
+                    }
+                });
+                return;
+            }
+            bool failed = false;
+            for (auto& node : removed) {
+                try{
+                    removeCallback_(removeClientContext_, std::move(node));
+                }
+                catch(...){
+                    failed = true;
+                }
+            }
+            if (failed)
+                throw CallBackFailed();
+        }
+
+        // must be called with lock_ held, the victims are spliced into evicted
+        size_t prune(list_type& evicted) {
             size_t maxAllowed = maxSize_ + elasticity_;
             if (maxSize_ == 0 || cacheSize_ < maxAllowed) {
                 return 0;
             }
             size_t removedSize = 0;
             while (cacheSize_ > maxSize_) {
-                //Try to execute callback
-                if(removeCallback_){
-                    try{
-                        removeCallback_(removeClientContext_,keys_.back());
-                    }
-                    catch(...){
-                        throw CallBackFailed();
-                    }
-                }
-                //Remove from the LRU
-                size_t s = keys_.back().size;
-                cache_.erase(keys_.back().key);
-                keys_.pop_back();
+                auto victim = policy_.victim();
+                //Remove from the LRU, the callback runs once the lock is released
+                size_t s = victim->size;
+                stats_.evict(s);
+                cache_.erase(victim->key);
+                policy_.evict(victim, evicted);
                 removedSize+=s;
                 cacheSize_-=s;
             }
             return removedSize;
         }
     };
+
+    /**
+     * LRUCache handing out reference counted handles to immutable values: getCopy() returns a
+     * std::shared_ptr instead of copying the value, and the value stays alive for the holder of
+     * the handle even if the entry is evicted meanwhile
+     */
+    template <class Key, class T, class Lock = NullLock,
+    template <typename, typename> class Policy = LRUPolicy>
+    using HandleLRUCache = LRUCache<Key, std::shared_ptr<const T>, Lock,
+    LRUMap<Key, std::shared_ptr<const T>>, Policy>;
+
+#if defined(__cpp_lib_generic_unordered_lookup)
+    /**
+     * LRUCache keyed by std::string with heterogeneous lookup
+     */
+    template <class Value, class Lock = NullLock,
+    template <typename, typename> class Policy = LRUPolicy>
+    using StringLRUCache = LRUCache<std::string, Value, Lock,
+    std::unordered_map<std::string, typename std::list<KeyValuePair<std::string, Value>>::iterator,
+    StringHash, StringEqual>, Policy>;
+#endif
 }
 #endif // LRU_CACHE_HPP
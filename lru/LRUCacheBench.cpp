@@ -0,0 +1,334 @@
+/* @file LRUCacheBench.cpp */
+/*
+ * Benchmark of the lru caches on synthetic and recorded workloads.
+ *
+ * Build: g++ -std=c++17 -O2 -pthread LRUCacheBench.cpp -o LRUCacheBench
+ *
+ * Every thread replays its own share of the requests against the cache with the usual
+ * cache-aside pattern: getCopy(), and insert() of the key on a miss. Reported per cache
+ * and thread count: throughput, median and 99th percentile latency of a request (sampled)
+ * and hit rate. The keys are generated before the clock starts.
+ *
+ * Options (defaults in brackets):
+ *        --workload zipf|scan|trace  [zipf]
+ *                    zipf: keys drawn from a Zipf distribution over --keys keys
+ *                    scan: zipf interleaved with bursts of keys that are never requested again,
+ *                          --scan of the requests in bursts of 1000 (scan resistance)
+ *                    trace: the keys of --trace, one per line, numbers or any other token
+ *        --trace FILE
+ *        --keys N         distinct keys of zipf and scan [1000000]
+ *        --skew S         Zipf exponent [0.99]
+ *        --scan F         fraction of scan requests [0.3]
+ *        --capacity N     entries the cache holds [100000]
+ *        --ops N          requests per run, split between the threads [4000000]
+ *        --threads LIST   comma separated thread counts [1,2,4,8]
+ *        --caches LIST    comma separated caches to compare, see below [all]
+ *        --sample N       time one request out of N [16]
+ *
+ * Caches:
+ *        nolock      LRUCache<NullLock> (single thread runs only)
+ *        lru         LRUCache<std::mutex>
+ *        lru-shared  LRUCache<std::shared_mutex> promoting cold entries only (Promotion::ColdHalf)
+ *        clock, clockpro, tinylfu   LRUCache<std::mutex> with the policies of EvictionPolicies.hpp
+ *        sharded     ShardedLRUCache with 16 shards
+ *        concurrent  ConcurrentLRUCache
+ *        intrusive   IntrusiveLRUCache<std::mutex>
+ *        flat        FlatLRUCache<std::mutex>
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LRUCache.hpp"
+#include "ShardedLRUCache.hpp"
+#include "ConcurrentLRUCache.hpp"
+#include "EvictionPolicies.hpp"
+#include "IntrusiveLRUCache.hpp"
+#include "FlatLRUCache.hpp"
+
+using namespace lru;
+
+struct Options {
+    std::string workload = "zipf";
+    std::string trace;
+    size_t keys = 1000000;
+    double skew = 0.99;
+    double scan = 0.3;
+    size_t capacity = 100000;
+    size_t ops = 4000000;
+    std::vector<unsigned> threads = {1, 2, 4, 8};
+    std::vector<std::string> caches;
+    size_t sample = 16;
+};
+
+struct Result {
+    double opsPerSec;
+    double p50;
+    double p99;
+    double hitRate;
+};
+
+typedef std::vector<std::vector<std::uint64_t>> Requests;
+
+// spreads consecutive ranks over the key space so that hot keys don't share hash buckets
+static std::uint64_t scramble(std::uint64_t rank) {
+    return rank * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * draws ranks 0..n-1 with probability proportional to 1/(rank+1)^skew by inverting the
+ * cumulative distribution with a binary search
+ */
+class ZipfGenerator {
+    std::vector<double> cdf_;
+public:
+    ZipfGenerator(size_t n, double skew) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+            cdf_[i] = sum;
+        }
+        for (auto& c : cdf_)
+            c /= sum;
+    }
+    template <class Rng>
+    std::uint64_t operator()(Rng& rng) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return static_cast<std::uint64_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin());
+    }
+};
+
+static Requests makeRequests(const Options& o, unsigned threads) {
+    Requests requests(threads);
+    if (o.workload == "trace") {
+        std::ifstream in(o.trace);
+        if (!in) {
+            std::cerr << "can't read trace " << o.trace << std::endl;
+            std::exit(1);
+        }
+        std::string token;
+        size_t i = 0;
+        while (in >> token) {
+            char* end = nullptr;
+            std::uint64_t k = std::strtoull(token.c_str(), &end, 10);
+            if (*end != '\0')
+                k = std::hash<std::string>()(token);
+            requests[i++ % threads].push_back(scramble(k));
+        }
+        return requests;
+    }
+    ZipfGenerator zipf(o.keys, o.skew);
+    const bool scan = o.workload == "scan";
+    const size_t burst = 1000;
+    for (unsigned t = 0; t < threads; t++) {
+        std::mt19937_64 rng(t + 1);
+        std::bernoulli_distribution startScan(scan ? o.scan / burst / (1 - o.scan) : 0);
+        // scan keys are above the zipf key space and distinct between threads
+        std::uint64_t next = o.keys + static_cast<std::uint64_t>(t) * o.ops;
+        auto& r = requests[t];
+        r.reserve(o.ops / threads);
+        while (r.size() < o.ops / threads) {
+            if (startScan(rng)) {
+                for (size_t i = 0; i < burst && r.size() < o.ops / threads; i++)
+                    r.push_back(scramble(next++));
+            }
+            else {
+                r.push_back(scramble(zipf(rng)));
+            }
+        }
+    }
+    return requests;
+}
+
+template <class Cache>
+static Result replay(Cache& cache, const Requests& requests, size_t sample) {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned threads = static_cast<unsigned>(requests.size());
+    std::vector<std::vector<std::uint32_t>> latencies(threads);
+    std::vector<size_t> hits(threads, 0);
+    std::atomic<unsigned> ready(0);
+    std::atomic<bool> go(false);
+    auto worker = [&] (unsigned t) {
+        const auto& r = requests[t];
+        auto& lat = latencies[t];
+        lat.reserve(r.size() / sample + 1);
+        size_t h = 0;
+        ready++;
+        while (!go.load())
+            std::this_thread::yield();
+        for (size_t i = 0; i < r.size(); i++) {
+            const std::uint64_t k = r[i];
+            std::uint64_t v;
+            if (i % sample == 0) {
+                auto start = Clock::now();
+                bool hit = cache.getCopy(k, v);
+                if (!hit)
+                    cache.insert(k, k, 1);
+                lat.push_back(static_cast<std::uint32_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+                h += hit;
+            }
+            else if (cache.getCopy(k, v)) {
+                h++;
+            }
+            else {
+                cache.insert(k, k, 1);
+            }
+        }
+        hits[t] = h;
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++)
+        pool.emplace_back(worker, t);
+    while (ready.load() < threads)
+        std::this_thread::yield();
+    auto start = Clock::now();
+    go = true;
+    for (auto& th : pool)
+        th.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t total = 0, totalHits = 0;
+    std::vector<std::uint32_t> all;
+    for (unsigned t = 0; t < threads; t++) {
+        total += requests[t].size();
+        totalHits += hits[t];
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    }
+    auto percentile = [&] (double p) {
+        if (all.empty())
+            return 0.0;
+        size_t i = std::min(all.size() - 1, static_cast<size_t>(p * all.size()));
+        std::nth_element(all.begin(), all.begin() + i, all.end());
+        return static_cast<double>(all[i]);
+    };
+    Result res;
+    res.opsPerSec = total / seconds;
+    res.p50 = percentile(0.50);
+    res.p99 = percentile(0.99);
+    res.hitRate = total ? static_cast<double>(totalHits) / total : 0;
+    return res;
+}
+
+typedef std::function<Result(const Requests&, const Options&)> Bench;
+
+template <class Cache, class Make>
+static Bench bench(Make make) {
+    return [make] (const Requests& requests, const Options& o) {
+        std::unique_ptr<Cache> cache(make(o.capacity));
+        return replay(*cache, requests, std::max<size_t>(o.sample, 1));
+    };
+}
+
+template <class Cache>
+static Bench bench() {
+    // 1/16 of elasticity, the caches prune back to capacity in batches
+    return bench<Cache>([] (size_t capacity) { return new Cache(capacity, capacity / 16); });
+}
+
+static std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> parts;
+    std::stringstream in(s);
+    std::string part;
+    while (std::getline(in, part, ','))
+        parts.push_back(part);
+    return parts;
+}
+
+int main(int argc, char** argv) {
+    typedef std::uint64_t K;
+    typedef std::uint64_t V;
+    const std::vector<std::pair<std::string, Bench>> benches = {
+        {"nolock", bench<LRUCache<K, V>>()},
+        {"lru", bench<LRUCache<K, V, std::mutex>>()},
+        {"lru-shared", bench<LRUCache<K, V, std::shared_mutex>>([] (size_t capacity) {
+            auto cache = new LRUCache<K, V, std::shared_mutex>(capacity, capacity / 16);
+            cache->setPromotion(Promotion::ColdHalf);
+            return cache;
+        })},
+        {"clock", bench<ClockCache<K, V, std::mutex>>()},
+        {"clockpro", bench<ClockProCache<K, V, std::mutex>>()},
+        {"tinylfu", bench<TinyLFUCache<K, V, std::mutex>>()},
+        {"sharded", bench<ShardedLRUCache<K, V, 16>>()},
+        {"concurrent", bench<ConcurrentLRUCache<K, V>>()},
+        {"intrusive", bench<IntrusiveLRUCache<K, V, std::mutex>>()},
+        {"flat", bench<FlatLRUCache<K, V, std::mutex>>()},
+    };
+
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--workload") o.workload = value;
+        else if (arg == "--trace") o.trace = value;
+        else if (arg == "--keys") o.keys = std::stoull(value);
+        else if (arg == "--skew") o.skew = std::stod(value);
+        else if (arg == "--scan") o.scan = std::stod(value);
+        else if (arg == "--capacity") o.capacity = std::stoull(value);
+        else if (arg == "--ops") o.ops = std::stoull(value);
+        else if (arg == "--sample") o.sample = std::stoull(value);
+        else if (arg == "--caches") o.caches = split(value);
+        else if (arg == "--threads") {
+            o.threads.clear();
+            for (const auto& t : split(value))
+                o.threads.push_back(static_cast<unsigned>(std::max(1, std::stoi(t))));
+        }
+        else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (o.workload == "trace" && o.trace.empty()) {
+        std::cerr << "--workload trace needs --trace FILE" << std::endl;
+        return 1;
+    }
+    if (o.scan < 0 || o.scan >= 1) {
+        std::cerr << "--scan must be in [0, 1)" << std::endl;
+        return 1;
+    }
+    if (o.workload != "zipf" && o.workload != "scan" && o.workload != "trace") {
+        std::cerr << "unknown workload " << o.workload << std::endl;
+        return 1;
+    }
+
+    std::cout << "workload " << o.workload << " capacity " << o.capacity;
+    if (o.workload != "trace")
+        std::cout << " keys " << o.keys << " skew " << o.skew << " requests " << o.ops;
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(12) << "cache" << std::right << std::setw(8) << "threads"
+              << std::setw(14) << "ops/sec" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+              << std::setw(10) << "hit %" << std::endl;
+    for (unsigned threads : o.threads) {
+        Requests requests = makeRequests(o, threads);
+        for (const auto& b : benches) {
+            if (!o.caches.empty() && std::find(o.caches.begin(), o.caches.end(), b.first) == o.caches.end())
+                continue;
+            if (b.first == "nolock" && threads > 1)
+                continue;
+            Result r = b.second(requests, o);
+            std::cout << std::left << std::setw(12) << b.first << std::right << std::setw(8) << threads
+                      << std::setw(14) << std::fixed << std::setprecision(0) << r.opsPerSec
+                      << std::setw(10) << r.p50 << std::setw(10) << r.p99
+                      << std::setw(10) << std::setprecision(2) << 100 * r.hitRate << std::endl;
+        }
+    }
+    return 0;
+}
@@ -1,11 +1,29 @@
 /* @file LRUCacheTest.cpp */
+// Build with the bzip2 sources for TieredLRUCache, e.g. g++ -std=c++17 LRUCacheTest.cpp ../bzip2/*.cpp -lpthread
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <tuple>
 #include <memory>
+#include <shared_mutex>
 #include "LRUCache.hpp"
+#include "ShardedLRUCache.hpp"
+#include "ConcurrentLRUCache.hpp"
+#include "EvictionPolicies.hpp"
+#include "IntrusiveLRUCache.hpp"
+#include "ExpiringLRUCache.hpp"
+#include "Snapshot.hpp"
+#include "SharedMemoryLRUCache.hpp"
+#include "TieredLRUCache.hpp"
+#include "FlatLRUCache.hpp"
+#include "AsyncLRUCache.hpp"
 
 using namespace lru;
 
@@ -100,12 +118,787 @@ public:
         cachePrint(lc);
     }
     
+    // Test the sharded version where every shard has its own lock
+    void testSharded() {
+        std::cout << "Testing the sharded version " << std::endl;
+        using SCache = ShardedLRUCache<std::string, std::string, 4>;
+        SCache sc(40,8);
+        auto worker = [&] (int t) {
+            for (int i = 0; i < 100; i++) {
+                std::ostringstream os;
+                os << "id:"<<t<<":"<<i;
+                sc.insert(os.str(), os.str(), 1);
+                std::string v;
+                sc.getCopy(os.str(), v);
+            }
+        };
+        std::vector<std::unique_ptr<std::thread>> workers;
+        workers.reserve(8);
+        for (int i = 0; i < 8; i++) {
+            workers.push_back(std::unique_ptr<std::thread>(
+                                                           new std::thread(worker, i)));
+        }
+        
+        for (const auto& w : workers) {
+            w->join();
+        }
+        std::cout << "... workers finished!" << std::endl;
+        std::cout << "Cache (size: "<<sc.size()<<") (shards="<<SCache::shardCount()<<") (allowed:" << sc.getMaxAllowedSize()<<")"<< std::endl;
+        std::cout << "... size should not exceed allowed size..." << std::endl;
+        sc.insert("hello", "world", 1);
+        std::cout << " ... hello => " << sc.get("hello") << std::endl;
+        try {
+            SCache tiny(3, 0);
+            std::cout << "... maxSize below the shard count accepted: " << tiny.getMaxSize() << std::endl;
+        }
+        catch (const std::invalid_argument&) {
+            std::cout << "... maxSize below the shard count rejected" << std::endl;
+        }
+        sc.updateSize(8, 0);
+        std::cout << "... resized (should be 8 and at most 8): " << sc.getMaxSize() << " " << sc.size() << std::endl;
+    }
+    
+    // Test the read-mostly version where hits are buffered and replayed in batches
+    void testConcurrentReads() {
+        std::cout << "Testing the concurrent read version " << std::endl;
+        using CCache = ConcurrentLRUCache<int, int>;
+        CCache cc(100,10);
+        for (int i = 0; i < 100; i++) {
+            cc.insert(i, i, 1);
+        }
+        auto reader = [&] () {
+            int v;
+            for (int round = 0; round < 1000; round++) {
+                for (int i = 0; i < 50; i++) {
+                    cc.getCopy(i, v);
+                }
+            }
+        };
+        std::vector<std::unique_ptr<std::thread>> readers;
+        readers.reserve(4);
+        for (int i = 0; i < 4; i++) {
+            readers.push_back(std::unique_ptr<std::thread>(
+                                                           new std::thread(reader)));
+        }
+        
+        for (const auto& r : readers) {
+            r->join();
+        }
+        // evict 20 entries, the hot half was read and must survive
+        for (int i = 100; i < 120; i++) {
+            cc.insert(i, i, 1);
+        }
+        std::cout << "... readers finished! (size: "<<cc.size()<<")" << std::endl;
+        std::cout << "... 0 should be kept: " << cc.contains(0) << std::endl;
+        std::cout << "... 99 should be kept: " << cc.contains(99) << std::endl;
+        std::cout << "... 50 should be evicted: " << !cc.contains(50) << std::endl;
+
+        // a reader holds the stripe of its thread only, a writer needs all of them
+        StripedSharedMutex<4> striped;
+        striped.lock_shared();
+        bool writerBlocked = !striped.try_lock();
+        striped.unlock_shared();
+        bool writerLocked = striped.try_lock();
+        if (writerLocked)
+            striped.unlock();
+        std::cout << "... writer blocked by a reader: " << writerBlocked << " then locked: " << writerLocked << std::endl;
+
+        struct Named {
+            std::string name;
+            explicit Named(const std::string& n) : name(n) {}
+        };
+        ConcurrentLRUCache<int, Named> named(4, 0);
+        named.insert(1, Named("one"), 1);
+        std::cout << "... value without a default constructor: " << named.getCopy(1).name << std::endl;
+    }
+    
+    // Test the CLOCK and CLOCK-Pro eviction policies
+    void testClockPolicies() {
+        std::cout << "Testing the CLOCK policies " << std::endl;
+        ClockCache<int, int> clock(4, 0);
+        for (int i = 0; i < 4; i++) {
+            clock.insert(i, i, 1);
+        }
+        clock.get(0);
+        clock.insert(4, 4, 1);
+        std::cout << "... 0 was referenced and should be kept: " << clock.contains(0) << std::endl;
+        std::cout << "... 1 should be evicted: " << !clock.contains(1) << std::endl;
+        
+        // a CLOCK hit only sets the reference bit, under the shared lock
+        ClockCache<int, int, CountingSharedLock> shared(4, 0);
+        shared.insert(0, 0, 1);
+        shared.insert(1, 1, 1);
+        CountingSharedLock::exclusive = CountingSharedLock::sharedLocks = 0;
+        shared.get(0);
+        std::cout << "... CLOCK hit locks, exclusive (should be 0): " << CountingSharedLock::exclusive
+                  << " shared (should be 1): " << CountingSharedLock::sharedLocks << std::endl;
+        shared.insert(2, 2, 1);
+        shared.insert(3, 3, 1);
+        shared.insert(4, 4, 1);
+        std::cout << "... 0 was referenced under the shared lock and should be kept: " << shared.contains(0) << std::endl;
+
+        ClockProCache<int, int> pro(100, 0);
+        LRUCache<int, int> plain(100, 0);
+        std::cout << "... hot keys kept after a scan: CLOCK-Pro " << scanSurvivors(pro) << " LRU " << scanSurvivors(plain) << std::endl;
+        std::cout << "... size (CLOCK-Pro: " << pro.size() << ") (LRU: " << plain.size() << ")" << std::endl;
+    }
+    
+    // a hot working set of 50 keys followed by a one-time scan larger than the cache
+    template <class Cache>
+    static size_t scanSurvivors(Cache& c) {
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 50; i++) {
+                int v;
+                if (!c.getCopy(i, v))
+                    c.insert(i, i, 1);
+            }
+        }
+        for (int i = 1000; i < 1200; i++) {
+            c.insert(i, i, 1);
+        }
+        size_t kept = 0;
+        for (int i = 0; i < 50; i++) {
+            kept += c.contains(i);
+        }
+        return kept;
+    }
+    
+    // Test the W-TinyLFU admission policy
+    void testTinyLFU() {
+        std::cout << "Testing the W-TinyLFU policy " << std::endl;
+        TinyLFUCache<int, int> lfu(100, 0);
+        std::cout << "... hot keys kept after a scan: W-TinyLFU " << scanSurvivors(lfu) << std::endl;
+        std::cout << "... size (W-TinyLFU: " << lfu.size() << ")" << std::endl;
+        lfu.remove(0);
+        lfu.updateSize(10, 0);
+        std::cout << "... size after shrinking (W-TinyLFU: " << lfu.size() << ")" << std::endl;
+
+        // a byte budget doesn't size the sketch, the entries do
+        TinyLFUPolicy<int, int> policy;
+        policy.resize(1 << 30);
+        for (int i = 0; i < 3; i++)
+            policy.emplace(i, i, 1);
+        std::cout << "... sketch of 3 entries in 1GB (should be 16): " << policy.sketch().capacity() << std::endl;
+        for (int i = 3; i < 20; i++)
+            policy.emplace(i, i, 1);
+        std::cout << "... sketch of 20 entries (should be 32): " << policy.sketch().capacity() << std::endl;
+    }
+    
+    // Test the pool backed version with a single node per entry
+    void testIntrusive() {
+        std::cout << "Testing the intrusive version " << std::endl;
+        using ICache = IntrusiveLRUCache<std::string, int>;
+        auto cachePrint =
+        [&] (const ICache& c) {
+            std::cout << "Cache (size: "<<c.size()<<") (max="<<c.getMaxSize()<<") (e="<<c.getElasticity()<<") (allowed:" << c.getMaxAllowedSize()<<")"<< std::endl;
+            size_t index = 0;
+            auto nodePrint = [&] (const ICache::node_type& n) {
+                std::cout << " ... [" << ++index <<"] " << n.key << " => " << n.value <<" size = "<<n.size<< std::endl;
+            };
+            c.cwalk(nodePrint);
+        };
+        ICache ic(10, 2);
+        for (int i = 0; i < 12; i++) {
+            ic.insert("key" + std::to_string(i), i, 1);
+        }
+        ic.get("key5");
+        ic.insert("key12", 12, 1);
+        std::cout << "... key0 and key1 should be evicted and key5 on top..." << std::endl;
+        cachePrint(ic);
+        ic.remove("key5");
+        std::cout << "... key5 should be removed: " << !ic.contains("key5") << std::endl;
+    }
+    
+    // a value that counts how often it was copied
+    struct Payload {
+        static int copies;
+        std::vector<char> bytes;
+        Payload() {}
+        explicit Payload(size_t n) : bytes(n, 'x') {}
+        Payload(const Payload& o) : bytes(o.bytes) { copies++; }
+        Payload(Payload&& o) = default;
+        Payload& operator=(const Payload& o) { bytes = o.bytes; copies++; return *this; }
+        Payload& operator=(Payload&& o) = default;
+    };
+    
+    // Test that values are moved or built in place instead of copied
+    void testMoveSemantics() {
+        std::cout << "Testing move and in place construction " << std::endl;
+        LRUCache<std::string, Payload> pc(2, 0);
+        Payload::copies = 0;
+        pc.insert("a", Payload(4096), 1);
+        pc.emplace("b", 1, 4096);
+        std::cout << "... try_emplace of an existing key should fail: " << !pc.try_emplace("b", 1, 1) << std::endl;
+        pc.insert("b", Payload(16), 1);
+        pc.emplace("c", 1, 4096);
+        std::cout << "... copies (should be 0): " << Payload::copies << std::endl;
+        
+        HandleLRUCache<std::string, Payload> hc(2, 0);
+        hc.insert("a", std::make_shared<const Payload>(4096), 1);
+        std::shared_ptr<const Payload> handle = hc.getCopy("a");
+        hc.insert("b", std::make_shared<const Payload>(16), 1);
+        hc.insert("c", std::make_shared<const Payload>(16), 1);
+        std::cout << "... a is evicted but the handle keeps it alive: " << !hc.contains("a") << " " << handle->bytes.size() << std::endl;
+        std::cout << "... copies (should be 0): " << Payload::copies << std::endl;
+    }
+    
+    // Test that concurrent misses on the same key run a single loader
+    void testGetOrLoad() {
+        std::cout << "Testing get or load " << std::endl;
+        using LCache = LRUCache<std::string, std::string, std::mutex>;
+        LCache lc(10, 2);
+        std::atomic<int> loads(0);
+        auto loader = [&] (const std::string& k) {
+            loads++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return "loaded:" + k;
+        };
+        std::vector<std::unique_ptr<std::thread>> workers;
+        workers.reserve(8);
+        for (int i = 0; i < 8; i++) {
+            workers.push_back(std::unique_ptr<std::thread>(
+                                                           new std::thread([&] () { lc.getOrLoad("hello", loader); })));
+        }
+        for (const auto& w : workers) {
+            w->join();
+        }
+        std::cout << " ... hello => " << lc.get("hello") << " (loads: " << loads << ", should be 1)" << std::endl;
+        
+        try {
+            lc.getOrLoad("fail", [] (const std::string&) -> std::string { throw std::runtime_error("backend down"); });
+        }
+        catch (const std::runtime_error& e) {
+            std::cout << "... loader error should be propagated: " << e.what() << std::endl;
+        }
+        std::cout << "... fail should not be cached: " << !lc.contains("fail") << std::endl;
+        
+        std::vector<std::thread> executor;
+        std::shared_future<std::string> f = lc.getOrLoadAsync("async", loader,
+            [&] (std::function<void()> task) { executor.emplace_back(std::move(task)); });
+        std::cout << " ... async => " << f.get() << std::endl;
+        for (auto& t : executor)
+            t.join();
+
+        // any associative container can hold the entries, an ordered one too
+        using OrderedMap = std::map<int, std::list<KeyValuePair<int, int>>::iterator>;
+        LRUCache<int, int, std::mutex, OrderedMap> ordered(2, 0);
+        ordered.getOrLoad(1, [] (int k) { return k * 10; });
+        ordered.insert(2, 20, 1);
+        ordered.insert(3, 30, 1);
+        std::cout << "... std::map cache, 1 evicted: " << !ordered.contains(1) << " 3 => " << ordered.get(3) << std::endl;
+    }
+    
+    // Test that remove callbacks run outside the lock and can take the evicted values
+    void testEvictionCallbacks() {
+        std::cout << "Testing eviction callbacks " << std::endl;
+        using LCache = LRUCache<std::string, std::string, std::mutex>;
+        std::vector<std::string> spilled;
+        LCache* self = nullptr;
+        // the callback calls back into the cache, which would deadlock under the cache lock
+        auto spill = [&] (void*, LCache::node_type&& n) {
+            spilled.push_back(std::move(n.value));
+            self->size();
+        };
+        LCache lc(2, 0, nullptr, spill);
+        self = &lc;
+        lc.insert("a", "first", 1);
+        lc.insert("b", "second", 1);
+        lc.insert("c", "third", 1);
+        lc.remove("b");
+        std::cout << " ... spilled (should be first second): ";
+        for (const auto& v : spilled)
+            std::cout << v << " ";
+        std::cout << std::endl;
+        
+        std::vector<std::function<void()>> queue;
+        auto failing = [] (void*, LCache::node_type&&) { throw std::runtime_error("disk full"); };
+        LCache deferred(2, 0, nullptr, failing, nullptr, nullptr,
+                        [&] (std::function<void()> task) { queue.push_back(std::move(task)); });
+        deferred.insert("a", "first", 1);
+        deferred.insert("b", "second", 1);
+        deferred.insert("c", "third", 1);
+        std::cout << "... eviction should be queued: " << queue.size() << std::endl;
+        for (auto& task : queue)
+            task();
+        
+        LCache direct(2, 0, nullptr, failing);
+        direct.insert("a", "first", 1);
+        direct.insert("b", "second", 1);
+        try {
+            direct.insert("c", "third", 1);
+        }
+        catch (const CallBackFailed&) {
+            std::cout << "... callback failure reported after pruning, size: " << direct.size() << std::endl;
+        }
+
+        checkFailingInsertCallback<LRUCache<int, int>>("LRUCache");
+        checkFailingInsertCallback<ConcurrentLRUCache<int, int>>("ConcurrentLRUCache");
+        checkFailingInsertCallback<FlatLRUCache<int, int>>("FlatLRUCache");
+        checkFailingInsertCallback<IntrusiveLRUCache<int, int>>("IntrusiveLRUCache");
+    }
+
+    // a failing insert callback must not leave the cache over its size
+    template <class Cache>
+    void checkFailingInsertCallback(const char* name) {
+        std::vector<int> evicted;
+        auto rejecting = [] (void*, const typename Cache::node_type& n) {
+            if (n.key == 3)
+                throw std::runtime_error("rejected");
+        };
+        Cache cache(2, 0, rejecting, [&] (void*, typename Cache::node_type&& n) { evicted.push_back(n.key); });
+        cache.insert(1, 1, 1);
+        cache.insert(2, 2, 1);
+        try {
+            cache.insert(3, 3, 1);
+        }
+        catch (const CallBackFailed&) {
+            std::cout << "... " << name << " insert callback failure still prunes, size (should be 2): "
+                      << cache.size() << " evicted (should be 1): " << (evicted.empty() ? 0 : evicted.front())
+                      << std::endl;
+        }
+    }
+    
+    // Test the batch operations taking the lock once per call
+    void testBatch() {
+        std::cout << "Testing batch operations " << std::endl;
+        typedef std::tuple<std::string, int, size_t> Entry;
+        std::vector<Entry> entries;
+        std::vector<std::string> keys;
+        for (int i = 0; i < 20; i++) {
+            entries.push_back(Entry("key" + std::to_string(i), i, 1));
+            keys.push_back("key" + std::to_string(i));
+        }
+        keys.push_back("missing");
+        std::vector<std::pair<std::string, int>> found;
+        
+        LRUCache<std::string, int, std::mutex> lc(10, 0);
+        lc.insertMany(entries.begin(), entries.end());
+        lc.getMany(keys.begin(), keys.end(), std::back_inserter(found));
+        std::cout << " ... found (should be 10): " << found.size() << std::endl;
+        std::cout << "... removed (should be 10): " << lc.removeMany(keys.begin(), keys.end()) << " " << lc.empty() << std::endl;
+        
+        ShardedLRUCache<std::string, int, 4> sc(1000, 0);
+        sc.insertMany(entries.begin(), entries.end());
+        found.clear();
+        sc.getMany(keys.begin(), keys.end(), std::back_inserter(found));
+        std::cout << " ... found (should be 20): " << found.size() << std::endl;
+        std::cout << "... removed (should be 20): " << sc.removeMany(keys.begin(), keys.end()) << std::endl;
+        
+        IntrusiveLRUCache<std::string, int, std::mutex> ic(100, 0);
+        ic.insertMany(entries.begin(), entries.end());
+        found.clear();
+        ic.getMany(keys.begin(), keys.end(), std::back_inserter(found));
+        std::cout << " ... found (should be 20): " << found.size() << std::endl;
+        std::cout << "... removed (should be 20): " << ic.removeMany(keys.begin(), keys.end()) << " " << ic.empty() << std::endl;
+    }
+    
+    // Test peek and sampled promotion with a reader-writer lock
+    void testPeekAndPromotion() {
+        std::cout << "Testing peek and promotion " << std::endl;
+        using SCache = LRUCache<std::string, int, std::shared_mutex>;
+        SCache sc(3, 0);
+        sc.insert("a", 1, 1);
+        sc.insert("b", 2, 1);
+        sc.insert("c", 3, 1);
+        // peek does not save a from eviction
+        std::cout << " ... a => " << sc.peek("a") << std::endl;
+        sc.insert("d", 4, 1);
+        std::cout << "... a should be evicted: " << !sc.contains("a") << std::endl;
+        
+        sc.setPromotion(Promotion::ColdHalf);
+        // d is the most recent entry, a hit on it is served under the shared lock
+        std::cout << " ... d => " << sc.get("d") << std::endl;
+        // b is in the cold half and gets promoted
+        std::cout << " ... b => " << sc.get("b") << std::endl;
+        sc.insert("e", 5, 1);
+        std::cout << "... b should be kept, c evicted: " << sc.contains("b") << " " << !sc.contains("c") << std::endl;
+        
+        sc.setPromotion(Promotion::EveryNth, 4);
+        std::vector<std::unique_ptr<std::thread>> readers;
+        for (int i = 0; i < 4; i++) {
+            readers.push_back(std::unique_ptr<std::thread>(new std::thread([&] () {
+                int v;
+                for (int j = 0; j < 1000; j++)
+                    sc.getCopy("e", v);
+            })));
+        }
+        for (const auto& r : readers) {
+            r->join();
+        }
+        std::cout << "... size after concurrent reads: " << sc.size() << std::endl;
+
+        // a hit left for the exclusive lock counts once, a miss if the entry went in between
+        using CCache = LRUCache<int, int, std::shared_mutex, LRUMap<int, int>, LRUPolicy, UnitWeigher, ConcurrentStats<>>;
+        CCache cc(8, 0);
+        cc.setPromotion(Promotion::EveryNth, 2);
+        std::atomic<int> lookups(0);
+        std::vector<std::unique_ptr<std::thread>> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.push_back(std::unique_ptr<std::thread>(new std::thread([&cc, &lookups, t] () {
+                int v;
+                for (int i = 0; i < 2000; i++) {
+                    if (t == 0) {
+                        cc.insert(i % 16, i, 1);
+                    } else {
+                        cc.getCopy((i * 3 + t) % 16, v);
+                        lookups++;
+                    }
+                }
+            })));
+        }
+        for (const auto& w : workers) {
+            w->join();
+        }
+        CacheStats st = cc.stats();
+        std::cout << "... hits + misses match the lookups: " << (st.hits + st.misses == static_cast<std::uint64_t>(lookups.load())) << std::endl;
+
+        // getOrLoad promotes as set by setPromotion too
+        SCache lc(4, 0);
+        lc.insert("a", 1, 1);
+        lc.insert("b", 2, 1);
+        lc.insert("c", 3, 1);
+        lc.insert("d", 4, 1);
+        lc.setPromotion(Promotion::ColdHalf);
+        auto loader = [] (const std::string&) { return 0; };
+        // c is in the hot half and stays where it is, a is promoted
+        lc.getOrLoad("c", loader);
+        lc.getOrLoad("a", loader);
+        lc.insert("e", 5, 1);
+        lc.insert("f", 6, 1);
+        std::cout << "... c evicted, d and a kept: " << !lc.contains("c") << " " << lc.contains("d") << " " << lc.contains("a") << std::endl;
+    }
+    
+    // Test sizing entries with a weigher and the resident memory estimate
+    void testWeigher() {
+        std::cout << "Testing weighers " << std::endl;
+        struct LengthWeigher {
+            size_t operator()(const std::string&, const std::string& v) const { return v.size(); }
+        };
+        LRUCache<std::string, std::string, std::mutex, LRUMap<std::string, std::string>, LRUPolicy, LengthWeigher> lc(10, 0);
+        lc.insert("short", std::string("abc"));
+        lc.insert("long", std::string("abcdefgh"));
+        std::cout << "... size should be 11 pruned to 8: " << lc.size() << " " << !lc.contains("short") << std::endl;
+        
+        // a 64KB budget of real memory
+        LRUCache<int, std::string, std::mutex, LRUMap<int, std::string>, LRUPolicy, ResidentWeigher> rc(64 * 1024, 0);
+        for (int i = 0; i < 1000; i++)
+            rc.insert(i, std::string(100, 'x'));
+        std::cout << " ... resident entries: " << rc.size() << " bytes, total with the map: " << rc.residentBytes()
+                  << " (should be close to 65536)" << std::endl;
+
+        // a string literal is weighed as the std::string stored, not as a char array
+        LRUCache<std::string, std::string, NullLock, LRUMap<std::string, std::string>, LRUPolicy, ResidentWeigher> sc(1 << 20, 0);
+        sc.insert("literal", "a value too long to fit in the small string buffer");
+        LRUCache<std::string, std::string, NullLock, LRUMap<std::string, std::string>, LRUPolicy, ResidentWeigher> tc(1 << 20, 0);
+        tc.insert(std::string("literal"), std::string("a value too long to fit in the small string buffer"));
+        std::cout << " ... literal and string weigh the same: " << (sc.size() == tc.size()) << std::endl;
+    }
+    
+    // Test the statistics of a cache shared by several threads
+    void testStats() {
+        std::cout << "Testing statistics " << std::endl;
+        using SCache = LRUCache<int, int, std::mutex, LRUMap<int, int>, LRUPolicy, UnitWeigher, ConcurrentStats<>>;
+        SCache sc(100, 0);
+        std::vector<std::unique_ptr<std::thread>> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.push_back(std::unique_ptr<std::thread>(new std::thread([&sc, t] () {
+                int v;
+                for (int i = 0; i < 1000; i++) {
+                    if (!sc.getCopy((i * 7 + t) % 200, v))
+                        sc.insert((i * 7 + t) % 200, i, 1);
+                }
+            })));
+        }
+        for (const auto& w : workers) {
+            w->join();
+        }
+        sc.getOrLoad(1000, [] (int k) { return k; });
+        CacheStats st = sc.stats();
+        std::cout << " ... hits + misses (should be 4001): " << st.hits + st.misses << " hit rate: " << st.hitRate() << std::endl;
+        std::cout << " ... inserts: " << st.inserts << " evictions: " << st.evictions << " (weight " << st.evictedWeight
+                  << ") loads: " << st.loads << " lock waits: " << st.lockWaits << " ("
+                  << std::chrono::duration_cast<std::chrono::microseconds>(st.lockWaitTime).count() << "us)" << std::endl;
+        
+        ShardedLRUCache<int, int, 4, std::mutex, std::hash<int>, UnitWeigher, ConcurrentStats<4>> shc(100, 0);
+        shc.insert(1, 1, 1);
+        shc.contains(1);
+        shc.getCopy(1);
+        std::cout << " ... sharded hits (should be 1): " << shc.stats().hits << std::endl;
+
+        // without timed stats a lock only needs lock() and unlock()
+        LRUCache<int, int, PlainLock> pc(2, 0);
+        pc.insert(1, 1, 1);
+        std::cout << " ... plain lock get (should be 1): " << pc.get(1) << std::endl;
+    }
+
+    // a reader-writer lock counting how often it was taken
+    struct CountingSharedLock {
+        static inline std::atomic<int> exclusive{0};
+        static inline std::atomic<int> sharedLocks{0};
+        std::shared_mutex m;
+        void lock() { m.lock(); exclusive++; }
+        void unlock() { m.unlock(); }
+        bool try_lock() { return m.try_lock() && ++exclusive; }
+        void lock_shared() { m.lock_shared(); sharedLocks++; }
+        void unlock_shared() { m.unlock_shared(); }
+    };
+
+    struct PlainLock {
+        std::mutex m;
+        void lock() { m.lock(); }
+        void unlock() { m.unlock(); }
+    };
+    
+    // Test saving a cache and restoring it in the same recency order
+    void testSnapshot() {
+        std::cout << "Testing snapshots " << std::endl;
+        LRUCache<std::string, int, std::mutex> lc(10, 0);
+        lc.insert("hello", 1, 1);
+        lc.insert("world", 2, 1);
+        lc.insert("this", 3, 2);
+        lc.insert("is", 4, 1);
+        lc.get("hello");
+        std::string path = "lru_snapshot_test.bin";
+        std::cout << " ... saved: " << saveSnapshot(lc, path) << std::endl;
+        
+        LRUCache<std::string, int, std::mutex> restored(10, 0);
+        std::cout << " ... restored: " << loadSnapshot(restored, path) << " size (should be 5): " << restored.size() << std::endl;
+        std::cout << " ... order (should be hello is this world):";
+        auto nodePrint = [&] (const LRU_Node& n) { std::cout << " " << n.key; };
+        restored.cwalk(nodePrint);
+        std::cout << std::endl;
+        
+        ShardedLRUCache<std::string, int, 4> sharded(100, 0);
+        std::cout << " ... restored into shards: " << loadSnapshot(sharded, path) << " " << sharded.contains("this") << std::endl;
+
+        // concurrent saves write their own temporary files, the last rename wins
+        std::thread saver([&] () { for (int i = 0; i < 20; i++) saveSnapshot(lc, path); });
+        for (int i = 0; i < 20; i++)
+            saveSnapshot(lc, path);
+        saver.join();
+        LRUCache<std::string, int, std::mutex> reloaded(10, 0);
+        std::cout << " ... reloaded after concurrent saves (should be 4): " << loadSnapshot(reloaded, path) << std::endl;
+        std::remove(path.c_str());
+    }
+    
+    // Test a cache shared through a shared memory segment, mapped twice as two processes would
+    void testSharedMemory() {
+        std::cout << "Testing shared memory cache " << std::endl;
+        struct Name {
+            char text[16];
+            bool operator==(const Name& o) const { return std::strcmp(text, o.text) == 0; }
+        };
+        struct NameHash {
+            size_t operator()(const Name& n) const { return std::hash<std::string>()(n.text); }
+        };
+        typedef SharedMemoryLRUCache<Name, int, NameHash> SCache;
+        const std::string segment = "/lru_cache_test";
+        SCache::destroy(segment);
+        SCache writer(segment, 64, 3, 0);
+        SCache reader(segment, 64);
+        Name hello = {"hello"}, world = {"world"}, other = {"other"}, last = {"last"};
+        writer.insert(hello, 1);
+        writer.insert(world, 2);
+        int v = 0;
+        std::cout << " ... hello => " << (reader.getCopy(hello, v) ? v : -1) << std::endl;
+        writer.insert(other, 3);
+        writer.insert(last, 4);
+        std::cout << "... world should be evicted: " << !reader.contains(world) << " size: " << reader.size() << std::endl;
+        SCache::destroy(segment);
+    }
+    
+    // Test spilling evicted entries to the second tier and promoting them back
+    void testTiered() {
+        std::cout << "Testing tiered cache " << std::endl;
+        TieredLRUCache<std::string, std::string, std::mutex, NullCompressor> tc(2, 0, 1024);
+        tc.insert("hello", "world", 1);
+        tc.insert("this", "is", 1);
+        tc.insert("a", "test", 1);
+        std::cout << "... hello should be spilled: " << !tc.resident("hello") << " " << tc.contains("hello")
+                  << " spilled: " << tc.spilledSize() << std::endl;
+        std::cout << " ... hello => " << tc.get("hello") << " spill hits: " << tc.spillHits() << std::endl;
+        std::cout << "... this should be spilled: " << !tc.resident("this") << std::endl;
+        std::cout << "... this should be removed: " << tc.remove("this") << " " << !tc.contains("this") << std::endl;
+
+        // a spilled entry too large for the shrunk first tier stays spilled
+        TieredLRUCache<std::string, std::string, std::mutex, NullCompressor> sc(2, 0, 1024);
+        sc.insert("big", "value", 2);
+        sc.insert("x", "y", 1);
+        sc.updateSize(1, 0);
+        try {
+            sc.get("big");
+        } catch (const TooLargeSize&) {
+            std::cout << "... big too large, still spilled: " << sc.contains("big") << std::endl;
+        }
+        sc.updateSize(2, 0);
+        std::cout << " ... big => " << sc.get("big") << std::endl;
+
+        // round trip through the default bzip2 compressor, an empty value included
+        TieredLRUCache<std::string, std::string, std::mutex> bz(1, 0, 1 << 20);
+        std::string page;
+        for (int i = 0; i < 200; i++)
+            page += "row " + std::to_string(i % 10) + " of a compressible page\n";
+        bz.insert("page", page, 1);
+        bz.insert("empty", "", 1);
+        bz.insert("last", "x", 1);
+        std::cout << "... page compressed (" << page.size() << " bytes to " << bz.spilledSize() << " spilled): "
+                  << (bz.spilledSize() < page.size()) << std::endl;
+        std::cout << "... page and empty round trip: " << (bz.get("page") == page) << " " << bz.get("empty").empty() << std::endl;
+    }
+    
+    // Test the flat layout for small trivially copyable entries
+    void testFlat() {
+        std::cout << "Testing flat cache " << std::endl;
+        CompactLRUCache<std::uint64_t, std::uint32_t> fc(3, 0);
+        fc.insert(1, 10, 1);
+        fc.insert(2, 20, 1);
+        fc.insert(3, 30, 1);
+        std::cout << " ... 1 => " << fc.get(1) << std::endl;
+        fc.insert(4, 40, 1);
+        std::cout << "... 2 should be evicted: " << !fc.contains(2) << " size: " << fc.size() << std::endl;
+        std::cout << "... 3 should be removed: " << fc.remove(3) << " " << !fc.contains(3) << std::endl;
+    }
+    
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+    // fire and forget coroutine driving the awaitable lookups
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    static Detached lookup(AsyncLRUCache<std::string, std::string>& ac, const std::string& k,
+                           std::function<std::string(const std::string&)> loader, std::string& out) {
+        out = co_await ac.get(k, loader);
+    }
+
+    // Test awaiting loads from coroutines, with a single load per key
+    void testAsync() {
+        std::cout << "Testing coroutine lookups " << std::endl;
+        std::vector<std::function<void()>> tasks;
+        AsyncLRUCache<std::string, std::string> ac([&] (std::function<void()> task) {
+            tasks.push_back(std::move(task));
+        }, 10, 2);
+        int loads = 0;
+        auto loader = [&] (const std::string& k) { loads++; return k + "!"; };
+        std::string first, second, third;
+        lookup(ac, "hello", loader, first);
+        lookup(ac, "hello", loader, second);
+        std::cout << "... both suspended on one load: " << (first.empty() && second.empty()) << " " << tasks.size() << std::endl;
+        tasks.front()();
+        std::cout << " ... hello => " << first << " " << second << " loads: " << loads << std::endl;
+        lookup(ac, "hello", loader, third);
+        std::cout << " ... hit without suspending => " << third << " loads: " << loads << std::endl;
+    }
+#endif
+    
+    // Test time to live expiration and refresh after write
+    void testExpiration() {
+        std::cout << "Testing expiration " << std::endl;
+        using ECache = ExpiringLRUCache<std::string, std::string, std::mutex>;
+        ECache ec(10, 2, std::chrono::milliseconds(50), std::chrono::milliseconds(20));
+        ec.insert("short", "lived", 1, std::chrono::milliseconds(10));
+        ec.insert("hello", "world", 1);
+        std::cout << " ... hello => " << ec.get("hello") << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::cout << "... short should be expired: " << !ec.contains("short") << std::endl;
+        int loads = 0;
+        auto loader = [&] (const std::string& k) {
+            loads++;
+            return "reloaded:" + k;
+        };
+        // past refreshAfterWrite, reloaded by this access
+        std::cout << " ... hello => " << ec.getOrLoad("hello", loader) << " (loads: " << loads << ", should be 1)" << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        std::cout << "... expired entries removed: " << ec.expire() << " size: " << ec.size() << std::endl;
+        std::cout << "... hello should be expired: " << !ec.contains("hello") << std::endl;
+
+        // a failed refresh keeps serving the current value
+        ec.insert("stale", "value", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(25));
+        std::string refreshed = ec.getOrLoad("stale", [] (const std::string&) -> std::string {
+            throw std::runtime_error("backend down");
+        });
+        std::cout << " ... stale => " << refreshed << " (refresh failed)" << std::endl;
+        std::cout << " ... stale => " << ec.getOrLoad("stale", loader) << " (refresh retried)" << std::endl;
+
+        // overwrites with the same time to live keep one deadline per entry
+        ECache overwritten(10, 2, std::chrono::seconds(10));
+        for (int i = 0; i < 1000; i++)
+            overwritten.insert("key", std::to_string(i), 1);
+        std::cout << "... deadlines after 1000 overwrites (should be 1): " << overwritten.scheduled() << std::endl;
+        ECache shortTtl(10, 2, std::chrono::milliseconds(5));
+        shortTtl.insert("key", "first", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        shortTtl.insert("key", "second", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        shortTtl.expire();
+        std::cout << " ... key => " << shortTtl.get("key") << " after the first deadline, pending: " << shortTtl.scheduled() << std::endl;
+
+        // an hour of 1ms ticks with a far deadline pending jumps over the empty slots
+        TimerWheel<int> wheel;
+        wheel.schedule(1, 5);
+        wheel.schedule(2, 10 * 3600000ull);
+        size_t fired = wheel.advance(3600000ull, [] (std::uint64_t, int) {});
+        std::cout << "... wheel fired (should be 1): " << fired << " pending: " << wheel.size() << std::endl;
+        fired = wheel.advance(10 * 3600000ull, [] (std::uint64_t, int) {});
+        std::cout << "... wheel fired (should be 1): " << fired << " pending: " << wheel.size() << std::endl;
+    }
+    
+#if defined(__cpp_lib_generic_unordered_lookup)
+    // Test lookups by std::string_view and precomputed hash on std::string keys
+    void testHeterogeneousLookup() {
+        std::cout << "Testing heterogeneous lookup " << std::endl;
+        StringLRUCache<int> sc(10, 2);
+        sc.insert("hello", 1, 1);
+        sc.insert("world", 2, 1);
+        std::string_view hello("hello");
+        Prehashed world("world");
+        std::cout << " ... hello => " << sc.get(hello) << std::endl;
+        std::cout << " ... world => " << sc.getCopy(world) << std::endl;
+        std::cout << "... world should be removed: " << sc.remove(world) << " " << !sc.contains(world) << std::endl;
+        
+        IntrusiveLRUCache<std::string, int, NullLock, StringHash, StringEqual> ic(10, 2);
+        ic.insert("hello", 1, 1);
+        std::cout << " ... hello => " << ic.get(Prehashed("hello")) << std::endl;
+    }
+#endif
+    
 };
 
+int lru_tests::Payload::copies = 0;
+
 int main(int argc, char** argv) {
    lru_tests tst;
    tst.testNoLock();
    tst.testWithLock();
+   tst.testSharded();
+   tst.testConcurrentReads();
+   tst.testClockPolicies();
+   tst.testTinyLFU();
+   tst.testIntrusive();
+   tst.testMoveSemantics();
+   tst.testGetOrLoad();
+   tst.testExpiration();
+   tst.testEvictionCallbacks();
+   tst.testBatch();
+   tst.testPeekAndPromotion();
+   tst.testWeigher();
+   tst.testStats();
+   tst.testSnapshot();
+   tst.testSharedMemory();
+   tst.testTiered();
+   tst.testFlat();
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+   tst.testAsync();
+#endif
+#if defined(__cpp_lib_generic_unordered_lookup)
+   tst.testHeterogeneousLookup();
+#endif
    return 0;
 }
 
@@ -0,0 +1,332 @@
+/* @file ShardedLRUCache.hpp*/
+#ifndef SHARDED_LRU_CACHE_HPP
+#define SHARDED_LRU_CACHE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    /**
+     * The ShardedLRUCache class templated by
+     *        Key - key type
+     *        Value - value type
+     *        N - number of independent shards
+     *        Lock - the lock type of every shard (default: std::mutex)
+     *        Hash - hash used to pick the shard of a key
+     *        Weigher - the size of the entries inserted without a size (see LRUCache)
+     *        Stats - the statistics kept by every shard (see LRUCache)
+     *
+     * Keys are hashed to one of N LRUCache shards, each with its own list, map and lock and a
+     * 1/N share of maxSize and elasticity. Operations on different shards never contend, so the
+     * cache scales with the number of threads instead of serializing them on one lock.
+     * Recency is tracked per shard: the evicted entry is the least recently used of its shard,
+     * which approximates global LRU order once the shards hold a reasonable number of keys.
+     */
+    template <class Key, class Value, size_t N = 16, class Lock = std::mutex,
+    class Hash = std::hash<Key>, class Weigher = UnitWeigher, class Stats = NullStats>
+    class ShardedLRUCache {
+        static_assert(N > 0, "ShardedLRUCache needs at least one shard");
+
+    public:
+        typedef LRUCache<Key, Value, Lock, LRUMap<Key, Value>, LRUPolicy, Weigher, Stats> shard_type;
+        typedef typename shard_type::node_type node_type;
+        typedef typename shard_type::Callback Callback;
+        typedef typename shard_type::RemoveCallback RemoveCallback;
+        typedef typename shard_type::Executor Executor;
+    private:
+        // Dissallow copying.
+        ShardedLRUCache(const ShardedLRUCache&) = delete;
+        ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+
+        /**
+         * the shards are stored inline, every one on its own cache lines so that the locks of
+         * neighbouring shards don't false share (a ShardedLRUCache allocated with new is only
+         * aligned from C++17 on)
+         */
+        struct alignas(64) Shard {
+            typename std::aligned_storage<sizeof(shard_type), alignof(shard_type)>::type storage;
+        };
+
+        mutable std::array<Shard, N> shards_;
+        Hash hash_;
+        std::atomic<size_t> maxSize_;
+        std::atomic<size_t> elasticity_;
+
+        shard_type& shard(size_t i) const {
+            return *reinterpret_cast<shard_type*>(&shards_[i].storage);
+        }
+
+        static size_t share(size_t total, size_t i) {
+            // spread the remainder over the first shards so the shares add up to total
+            return total / N + (i < total % N ? 1 : 0);
+        }
+
+        size_t shardIndex(const Key& k) const {
+            // std::hash is the identity for integers, mix the bits before reducing to a shard
+            uint64_t h = static_cast<uint64_t>(hash_(k));
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return h % N;
+        }
+
+        shard_type& shardFor(const Key& k) const {
+            return shard(shardIndex(k));
+        }
+
+        static void checkSize(size_t maxSize) {
+            // every shard needs room for one entry
+            if (maxSize != 0 && maxSize < N)
+                throw std::invalid_argument("max_size_smaller_than_the_number_of_shards");
+        }
+
+    public:
+        /**
+         * maxSize and elasticity are the budgets of the whole cache, every shard gets a 1/N share
+         * set maxSize = 0 for an unbounded cache
+         * This function throws std::invalid_argument when maxSize is below N, a shard could then
+         * hold no entry
+         */
+        explicit ShardedLRUCache(size_t maxSize = 64 * N, size_t elasticity = 10 * N,
+        Callback insertCallback = nullptr, RemoveCallback removeCallback = nullptr,
+        void * insertClientContext = nullptr, void * removeClientContext = nullptr,
+        Executor removeExecutor = nullptr)
+        : maxSize_(maxSize), elasticity_(elasticity) {
+            checkSize(maxSize);
+            size_t i = 0;
+            try {
+                // an unbounded cache stays unbounded in every shard, share(0, i) is 0
+                for (; i < N; i++) {
+                    new (&shards_[i].storage) shard_type(share(maxSize, i), share(elasticity, i),
+                        insertCallback, removeCallback, insertClientContext, removeClientContext, removeExecutor);
+                }
+            }
+            catch (...) {
+                while (i > 0)
+                    shard(--i).~shard_type();
+                throw;
+            }
+        }
+
+        virtual ~ShardedLRUCache() {
+            for (size_t i = 0; i < N; i++)
+                shard(i).~shard_type();
+        }
+
+        /**
+         * This function throws std::invalid_argument when maxSize is below N
+         */
+        void updateSize(size_t maxSize, size_t elasticity) {
+            checkSize(maxSize);
+            maxSize_ = maxSize;
+            elasticity_ = elasticity;
+            for (size_t i = 0; i < N; i++)
+                shard(i).updateSize(share(maxSize, i), share(elasticity, i));
+        }
+
+        /**
+         * the aggregated size of all shards, every shard is locked in turn so the result is
+         * not a snapshot of the whole cache under concurrent writers
+         */
+        size_t size() const {
+            size_t total = 0;
+            for (size_t i = 0; i < N; i++)
+                total += shard(i).size();
+            return total;
+        }
+
+        /**
+         * the statistics of all shards added up
+         */
+        CacheStats stats() const {
+            CacheStats total;
+            for (size_t i = 0; i < N; i++)
+                total += shard(i).stats();
+            return total;
+        }
+
+        /**
+         * the resident bytes of all shards, see LRUCache::residentBytes()
+         */
+        size_t residentBytes() const {
+            // the shards themselves are part of sizeof(*this)
+            size_t total = sizeof(*this);
+            for (size_t i = 0; i < N; i++)
+                total += shard(i).residentBytes() - sizeof(shard_type);
+            return total;
+        }
+
+        size_t freeSize() const {
+            size_t total = 0;
+            for (size_t i = 0; i < N; i++)
+                total += shard(i).freeSize();
+            return total;
+        }
+
+        bool empty() const {
+            for (size_t i = 0; i < N; i++) {
+                if (!shard(i).empty())
+                    return false;
+            }
+            return true;
+        }
+
+        void clear() {
+            for (size_t i = 0; i < N; i++)
+                shard(i).clear();
+        }
+
+        /**
+         * This function throws TooLargeSize when s doesn't fit in the share of a single shard
+         */
+        template <class K = Key, class V = Value>
+        void insert(K&& k, V&& v, const size_t & s, void * insertClientContext = nullptr) {
+            shardFor(k).insert(std::forward<K>(k), std::forward<V>(v), s, insertClientContext);
+        }
+
+        template <class K = Key, class V = Value>
+        void insert(K&& k, V&& v) {
+            shardFor(k).insert(std::forward<K>(k), std::forward<V>(v));
+        }
+
+        template <class K, class... Args>
+        bool emplace(K&& k, const size_t & s, Args&&... args) {
+            return shardFor(k).emplace(std::forward<K>(k), s, std::forward<Args>(args)...);
+        }
+
+        template <class K, class... Args>
+        bool try_emplace(K&& k, const size_t & s, Args&&... args) {
+            return shardFor(k).try_emplace(std::forward<K>(k), s, std::forward<Args>(args)...);
+        }
+
+        /**
+         * This function throws
+         * The const reference returned here is only
+         * guaranteed to be valid till the next insert/delete on the same shard
+         */
+        const Value& get(const Key& k) {
+            return shardFor(k).get(k);
+        }
+
+        Value getCopy(const Key& k) {
+            return shardFor(k).getCopy(k);
+        }
+
+        bool getCopy(const Key& k, Value& v) {
+            return shardFor(k).getCopy(k, v);
+        }
+
+        const Value& peek(const Key& k) const {
+            return shardFor(k).peek(k);
+        }
+
+        bool peek(const Key& k, Value& v) const {
+            return shardFor(k).peek(k, v);
+        }
+
+        /**
+         * sets the promotion of every shard, see LRUCache::setPromotion()
+         */
+        void setPromotion(Promotion promotion, size_t n = 1) {
+            for (size_t i = 0; i < N; i++)
+                shard(i).setPromotion(promotion, n);
+        }
+
+        template <class Loader>
+        Value getOrLoad(const Key& k, Loader&& loader, const size_t & s = 1) {
+            return shardFor(k).getOrLoad(k, std::forward<Loader>(loader), s);
+        }
+
+        template <class Loader>
+        std::shared_future<Value> getOrLoadAsync(const Key& k, Loader loader,
+        std::function<void(std::function<void()>)> executor, const size_t & s = 1) {
+            return shardFor(k).getOrLoadAsync(k, std::move(loader), std::move(executor), s);
+        }
+
+        bool remove(const Key& k) {
+            return shardFor(k).remove(k);
+        }
+
+        bool contains(const Key& k) const {
+            return shardFor(k).contains(k);
+        }
+
+        /**
+         * The batch operations group the keys by shard and lock every shard involved once.
+         * Results are written shard by shard, not in the order of the keys.
+         */
+        template <class KeyIt, class OutIt>
+        OutIt getMany(KeyIt first, KeyIt last, OutIt out) {
+            std::array<std::vector<Key>, N> groups;
+            for (; first != last; ++first)
+                groups[shardIndex(*first)].push_back(*first);
+            for (size_t i = 0; i < N; i++) {
+                if (!groups[i].empty())
+                    out = shard(i).getMany(groups[i].begin(), groups[i].end(), out);
+            }
+            return out;
+        }
+
+        /**
+         * This function throws TooLargeSize like insert(), the shards before the failing one
+         * are updated
+         */
+        template <class It>
+        void insertMany(It first, It last) {
+            typedef typename std::iterator_traits<It>::value_type entry_type;
+            std::array<std::vector<entry_type>, N> groups;
+            for (; first != last; ++first) {
+                entry_type e(*first);
+                size_t i = shardIndex(std::get<0>(e));
+                groups[i].push_back(std::move(e));
+            }
+            for (size_t i = 0; i < N; i++) {
+                if (!groups[i].empty())
+                    shard(i).insertMany(std::make_move_iterator(groups[i].begin()),
+                                                 std::make_move_iterator(groups[i].end()));
+            }
+        }
+
+        template <class KeyIt>
+        size_t removeMany(KeyIt first, KeyIt last) {
+            std::array<std::vector<Key>, N> groups;
+            for (; first != last; ++first)
+                groups[shardIndex(*first)].push_back(*first);
+            size_t removed = 0;
+            for (size_t i = 0; i < N; i++) {
+                if (!groups[i].empty())
+                    removed += shard(i).removeMany(groups[i].begin(), groups[i].end());
+            }
+            return removed;
+        }
+
+        size_t getMaxSize() const { return maxSize_; }
+        size_t getElasticity() const { return elasticity_; }
+        size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+        static constexpr size_t shardCount() { return N; }
+
+        /**
+         * walks the shards one after the other, each in its own LRU order
+         */
+        template <typename F>
+        void cwalk(F& f) const {
+            for (size_t i = 0; i < N; i++)
+                shard(i).cwalk(f);
+        }
+    };
+}
+#endif // SHARDED_LRU_CACHE_HPP
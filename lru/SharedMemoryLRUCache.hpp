@@ -0,0 +1,434 @@
+/* @file SharedMemoryLRUCache.hpp*/
+#ifndef SHARED_MEMORY_LRU_CACHE_HPP
+#define SHARED_MEMORY_LRU_CACHE_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    /**
+     * error raised when the shared memory segment can't be created, opened or locked
+     */
+    class SharedMemoryError : public std::runtime_error {
+    public:
+        explicit SharedMemoryError(const std::string& what) : std::runtime_error("shared_memory: " + what) {}
+    };
+
+    /**
+     * The SharedMemoryLRUCache class templated by
+     *        Key - key type, trivially copyable (use fixed size arrays for strings)
+     *        Value - value type, trivially copyable
+     *        Hash - hash of the key, must give the same result in every process
+     *
+     * An LRU cache living in a named POSIX shared memory segment (shm_open) that any number of
+     * processes on the host map and use together, instead of each keeping its own copy.
+     * The segment holds a header, a bucket array and a fixed number of entry slots. Entries are
+     * linked by 32-bit slot indices rather than pointers, so the segment works at whatever address
+     * each process maps it. Every operation runs under a process-shared robust mutex: if a
+     * process dies while holding it, the next one to lock it clears the cache (whose state
+     * may be half updated) and carries on.
+     * Sizes behave as in LRUCache; when all slots are in use an insert also evicts the least
+     * recently used entry. There are no callbacks since their code is not shared between
+     * processes. Requires robust mutexes (Linux), link with -lrt before glibc 2.34.
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>>
+    class SharedMemoryLRUCache {
+        static_assert(std::is_trivially_copyable<Key>::value, "shared memory keys must be trivially copyable");
+        static_assert(std::is_trivially_copyable<Value>::value, "shared memory values must be trivially copyable");
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the segment needs lock free 64 bit atomics");
+
+    public:
+        typedef KeyValuePair<Key, Value> node_type;
+    private:
+        // Dissallow copying.
+        SharedMemoryLRUCache(const SharedMemoryLRUCache&) = delete;
+        SharedMemoryLRUCache& operator=(const SharedMemoryLRUCache&) = delete;
+
+        static constexpr std::uint32_t kNil = 0xffffffffu;
+        static constexpr std::uint64_t kMagic = 0x4c525553484d3031ULL; // "LRUSHM01"
+
+        struct Slot {
+            Key key;
+            Value value;
+            std::uint64_t size;
+            std::uint32_t hash;
+            std::uint32_t prev;  // towards the most recent entry
+            std::uint32_t next;  // towards the least recent entry, or the next free slot
+            std::uint32_t chain; // next slot of the same bucket
+        };
+
+        struct Header {
+            std::atomic<std::uint64_t> ready; // kMagic once the creator initialized the segment
+            std::uint64_t segmentSize;
+            std::uint32_t capacity;
+            std::uint32_t bucketCount;
+            pthread_mutex_t mutex;
+            std::uint64_t maxSize;
+            std::uint64_t elasticity;
+            std::uint64_t cacheSize;
+            std::uint32_t count;
+            std::uint32_t head;
+            std::uint32_t tail;
+            std::uint32_t freeList;
+        };
+
+        /**
+         * locks the segment mutex, recovering it when its owner died
+         */
+        class Guard {
+            Header* header_;
+            SharedMemoryLRUCache& cache_;
+        public:
+            explicit Guard(SharedMemoryLRUCache& c) : header_(c.header_), cache_(c) {
+                int r = pthread_mutex_lock(&header_->mutex);
+                if (r == EOWNERDEAD) {
+                    cache_.reset();
+                    pthread_mutex_consistent(&header_->mutex);
+                }
+                else if (r != 0) {
+                    throw SharedMemoryError("can't lock the segment");
+                }
+            }
+            ~Guard() { pthread_mutex_unlock(&header_->mutex); }
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+        };
+
+        std::string name_;
+        void* base_;
+        size_t segmentSize_;
+        Header* header_;
+        std::uint32_t* buckets_;
+        Slot* slots_;
+        Hash hash_;
+
+        static size_t align(size_t n) {
+            return (n + 63) / 64 * 64;
+        }
+
+        static size_t bucketsFor(size_t capacity) {
+            size_t n = 16;
+            while (n < capacity)
+                n <<= 1;
+            return n;
+        }
+
+        static size_t layout(size_t capacity) {
+            return align(sizeof(Header)) + align(bucketsFor(capacity) * sizeof(std::uint32_t))
+                + capacity * sizeof(Slot);
+        }
+
+        // empties the cache, must be called with the mutex held or before the segment is published
+        void reset() {
+            Header& h = *header_;
+            for (std::uint32_t b = 0; b < h.bucketCount; b++)
+                buckets_[b] = kNil;
+            for (std::uint32_t i = 0; i < h.capacity; i++)
+                slots_[i].next = i + 1 < h.capacity ? i + 1 : kNil;
+            h.freeList = h.capacity ? 0 : kNil;
+            h.head = h.tail = kNil;
+            h.count = 0;
+            h.cacheSize = 0;
+        }
+
+        std::uint32_t hashOf(const Key& k) const {
+            return static_cast<std::uint32_t>(hash_(k));
+        }
+
+        std::uint32_t find(const Key& k, std::uint32_t h) const {
+            std::uint32_t i = buckets_[h & (header_->bucketCount - 1)];
+            while (i != kNil && !(slots_[i].hash == h && slots_[i].key == k))
+                i = slots_[i].chain;
+            return i;
+        }
+
+        void unlinkList(std::uint32_t i) {
+            Slot& s = slots_[i];
+            if (s.prev != kNil) slots_[s.prev].next = s.next; else header_->head = s.next;
+            if (s.next != kNil) slots_[s.next].prev = s.prev; else header_->tail = s.prev;
+        }
+
+        void pushFront(std::uint32_t i) {
+            Slot& s = slots_[i];
+            s.prev = kNil;
+            s.next = header_->head;
+            if (header_->head != kNil) slots_[header_->head].prev = i; else header_->tail = i;
+            header_->head = i;
+        }
+
+        void unlinkBucket(std::uint32_t i) {
+            std::uint32_t* link = &buckets_[slots_[i].hash & (header_->bucketCount - 1)];
+            while (*link != i)
+                link = &slots_[*link].chain;
+            *link = slots_[i].chain;
+        }
+
+        // removes slot i and returns it to the free list
+        void erase(std::uint32_t i) {
+            unlinkBucket(i);
+            unlinkList(i);
+            header_->cacheSize -= slots_[i].size;
+            header_->count--;
+            slots_[i].next = header_->freeList;
+            header_->freeList = i;
+        }
+
+        void prune() {
+            Header& h = *header_;
+            if (h.maxSize == 0 || h.cacheSize < h.maxSize + h.elasticity)
+                return;
+            while (h.cacheSize > h.maxSize && h.tail != kNil)
+                erase(h.tail);
+        }
+
+    public:
+        /**
+         * opens the segment called name (a shm_open name like "/my_cache"), creating it with
+         * room for capacity entries if it doesn't exist yet; maxSize and elasticity are those of
+         * the process creating the segment. Opening an existing segment made for another capacity
+         * or entry layout throws SharedMemoryError.
+         */
+        SharedMemoryLRUCache(const std::string& name, size_t capacity, size_t maxSize = 64, size_t elasticity = 10)
+        : name_(name), base_(nullptr), segmentSize_(layout(capacity)),
+          header_(nullptr), buckets_(nullptr), slots_(nullptr) {
+            if (capacity == 0 || capacity >= kNil)
+                throw SharedMemoryError("invalid capacity");
+            bool creator = true;
+            int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0 && errno == EEXIST) {
+                creator = false;
+                fd = shm_open(name.c_str(), O_RDWR, 0600);
+            }
+            if (fd < 0)
+                throw SharedMemoryError("can't open " + name);
+            if (creator && ftruncate(fd, static_cast<off_t>(segmentSize_)) != 0) {
+                close(fd);
+                shm_unlink(name.c_str());
+                throw SharedMemoryError("can't size " + name);
+            }
+            if (!creator) {
+                // the creator may still be sizing the segment
+                struct stat st;
+                for (int tries = 0; ; tries++) {
+                    if (fstat(fd, &st) != 0 || tries == 1000) {
+                        close(fd);
+                        throw SharedMemoryError("can't open " + name);
+                    }
+                    if (static_cast<size_t>(st.st_size) == segmentSize_)
+                        break;
+                    if (st.st_size != 0) {
+                        close(fd);
+                        throw SharedMemoryError(name + " has another layout");
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            base_ = mmap(nullptr, segmentSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (base_ == MAP_FAILED)
+                throw SharedMemoryError("can't map " + name);
+            char* p = static_cast<char*>(base_);
+            header_ = reinterpret_cast<Header*>(p);
+            buckets_ = reinterpret_cast<std::uint32_t*>(p + align(sizeof(Header)));
+            slots_ = reinterpret_cast<Slot*>(p + align(sizeof(Header)) + align(bucketsFor(capacity) * sizeof(std::uint32_t)));
+
+            if (creator) {
+                new (header_) Header();
+                header_->segmentSize = segmentSize_;
+                header_->capacity = static_cast<std::uint32_t>(capacity);
+                header_->bucketCount = static_cast<std::uint32_t>(bucketsFor(capacity));
+                header_->maxSize = maxSize;
+                header_->elasticity = elasticity;
+                pthread_mutexattr_t attr;
+                pthread_mutexattr_init(&attr);
+                pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+                pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+                pthread_mutex_init(&header_->mutex, &attr);
+                pthread_mutexattr_destroy(&attr);
+                reset();
+                header_->ready.store(kMagic, std::memory_order_release);
+            }
+            else {
+                for (int tries = 0; header_->ready.load(std::memory_order_acquire) != kMagic; tries++) {
+                    if (tries == 1000) {
+                        munmap(base_, segmentSize_);
+                        throw SharedMemoryError(name + " was never initialized");
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                if (header_->segmentSize != segmentSize_ || header_->capacity != capacity) {
+                    munmap(base_, segmentSize_);
+                    throw SharedMemoryError(name + " has another layout");
+                }
+            }
+        }
+
+        /**
+         * unmaps the segment, which stays available to the other processes
+         */
+        virtual ~SharedMemoryLRUCache() {
+            munmap(base_, segmentSize_);
+        }
+
+        /**
+         * removes the segment name, the processes mapping it keep using it until they unmap it
+         */
+        static bool destroy(const std::string& name) {
+            return shm_unlink(name.c_str()) == 0;
+        }
+
+        void updateSize(size_t maxSize, size_t elasticity) {
+            Guard g(*this);
+            header_->maxSize = maxSize;
+            header_->elasticity = elasticity;
+            prune();
+        }
+
+        size_t size() {
+            Guard g(*this);
+            return static_cast<size_t>(header_->cacheSize);
+        }
+
+        size_t freeSize() {
+            Guard g(*this);
+            return static_cast<size_t>(header_->maxSize + header_->elasticity - header_->cacheSize);
+        }
+
+        bool empty() {
+            Guard g(*this);
+            return header_->count == 0;
+        }
+
+        void clear() {
+            Guard g(*this);
+            reset();
+        }
+
+        /**
+         * This function throws TooLargeSize when s doesn't fit in the cache
+         */
+        void insert(const Key& k, const Value& v, const size_t & s = 1) {
+            Guard g(*this);
+            Header& h = *header_;
+            std::uint32_t hash = hashOf(k);
+            std::uint32_t i = find(k, hash);
+            if (i != kNil) {
+                std::uint64_t prev = slots_[i].size;
+                if (s > prev && s - prev > h.maxSize + h.elasticity - h.cacheSize)
+                    throw TooLargeSize();
+                slots_[i].value = v;
+                slots_[i].size = s;
+                h.cacheSize = h.cacheSize - prev + s;
+                unlinkList(i);
+                pushFront(i);
+            }
+            else {
+                if (s > h.maxSize + h.elasticity)
+                    throw TooLargeSize();
+                if (h.freeList == kNil)
+                    erase(h.tail);
+                i = h.freeList;
+                h.freeList = slots_[i].next;
+                Slot& slot = slots_[i];
+                slot.key = k;
+                slot.value = v;
+                slot.size = s;
+                slot.hash = hash;
+                std::uint32_t& bucket = buckets_[hash & (h.bucketCount - 1)];
+                slot.chain = bucket;
+                bucket = i;
+                pushFront(i);
+                h.count++;
+                h.cacheSize += s;
+            }
+            prune();
+        }
+
+        /**
+         * This function throws
+         * returns a copy of the stored object (if found), there is no get() returning a
+         * reference since another process may replace the entry at any time
+         */
+        Value getCopy(const Key& k) {
+            Value v;
+            if (!getCopy(k, v))
+                throw KeyNotFound();
+            return v;
+        }
+
+        /**
+         * Try to get the value for k and copy it to v and return true
+         */
+        bool getCopy(const Key& k, Value& v) {
+            Guard g(*this);
+            std::uint32_t i = find(k, hashOf(k));
+            if (i == kNil)
+                return false;
+            unlinkList(i);
+            pushFront(i);
+            v = slots_[i].value;
+            return true;
+        }
+
+        /**
+         * getCopy() without promoting the entry
+         */
+        bool peek(const Key& k, Value& v) {
+            Guard g(*this);
+            std::uint32_t i = find(k, hashOf(k));
+            if (i == kNil)
+                return false;
+            v = slots_[i].value;
+            return true;
+        }
+
+        bool remove(const Key& k) {
+            Guard g(*this);
+            std::uint32_t i = find(k, hashOf(k));
+            if (i == kNil)
+                return false;
+            erase(i);
+            return true;
+        }
+
+        bool contains(const Key& k) {
+            Guard g(*this);
+            return find(k, hashOf(k)) != kNil;
+        }
+
+        size_t getCapacity() const { return header_->capacity; }
+        size_t getMaxSize() { Guard g(*this); return static_cast<size_t>(header_->maxSize); }
+        size_t getElasticity() { Guard g(*this); return static_cast<size_t>(header_->elasticity); }
+
+        /**
+         * walks the entries in LRU order, most recently used first, f gets a copy of every entry
+         */
+        template <typename F>
+        void cwalk(F& f) {
+            Guard g(*this);
+            for (std::uint32_t i = header_->head; i != kNil; i = slots_[i].next) {
+                const node_type n(slots_[i].key, slots_[i].value, static_cast<size_t>(slots_[i].size));
+                f(n);
+            }
+        }
+    };
+}
+#endif // SHARED_MEMORY_LRU_CACHE_HPP
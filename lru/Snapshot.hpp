@@ -0,0 +1,347 @@
+/* @file Snapshot.hpp*/
+#ifndef LRU_SNAPSHOT_HPP
+#define LRU_SNAPSHOT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LRU_SNAPSHOT_MMAP 1
+#endif
+
+#include "LRUCache.hpp"
+
+namespace lru {
+
+    /**
+     * error raised when a snapshot can't be written or read back
+     */
+    class SnapshotError : public std::runtime_error {
+    public:
+        explicit SnapshotError(const std::string& what) : std::runtime_error("snapshot: " + what) {}
+    };
+
+    /**
+     * Codec<T> turns keys and values into bytes and back:
+     *        static void encode(const T& v, std::string& out) - append the bytes of v to out
+     *        static T decode(const char* data, size_t size) - rebuild a T from its bytes
+     * The default handles trivially copyable types but pointers, and std::string, specialize it (or pass
+     * another codec to saveSnapshot() and loadSnapshot()) for other types.
+     */
+    template <class T, class Enable = void>
+    struct Codec;
+
+    template <class T>
+    struct Codec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+        static_assert(!std::is_pointer<T>::value, "a pointer's bytes don't survive a reload, give Codec<T> a specialization");
+
+        static void encode(const T& v, std::string& out) {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+        }
+        static T decode(const char* data, size_t size) {
+            if (size != sizeof(T))
+                throw SnapshotError("bad record size");
+            T v;
+            std::memcpy(&v, data, sizeof(T));
+            return v;
+        }
+    };
+
+    template <>
+    struct Codec<std::string> {
+        static void encode(const std::string& v, std::string& out) {
+            out.append(v);
+        }
+        static std::string decode(const char* data, size_t size) {
+            return std::string(data, size);
+        }
+    };
+
+    namespace snapshot_detail {
+        /**
+         * File layout, in the byte order of the machine that wrote it:
+         *        magic (4 bytes) version (u32) count (u64)
+         *        count records: key length (u32) key, value length (u32) value, size (u64)
+         * Records are in the order of cwalk(), most recently used first for LRUPolicy.
+         */
+        static const char kMagic[4] = { 'L', 'R', 'U', 'S' };
+        static const std::uint32_t kVersion = 1;
+        static const size_t kHeaderSize = 16;
+
+        template <class T>
+        void put(std::string& out, T v) {
+            out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+        }
+
+        /**
+         * appends the u32 length of a key or a value, which must fit in it
+         */
+        inline void putLength(std::string& out, size_t n) {
+            if (n > UINT32_MAX)
+                throw SnapshotError("record field too large");
+            put<std::uint32_t>(out, static_cast<std::uint32_t>(n));
+        }
+
+        template <class T>
+        T get(const char* p) {
+            T v;
+            std::memcpy(&v, p, sizeof(T));
+            return v;
+        }
+
+        /**
+         * replaces path with data atomically: data goes to a uniquely named temporary file
+         * next to path, which is flushed to disk before being renamed to path, and the directory
+         * is flushed after the rename so that the new name survives a power loss too.
+         * Concurrent saves to the same path each use their own temporary file, the last rename wins.
+         * Without POSIX the data is only flushed to the operating system.
+         */
+        inline void writeAtomically(const std::string& path, const std::string& data) {
+#ifdef LRU_SNAPSHOT_MMAP
+            std::string tmp = path + ".XXXXXX";
+            int fd = ::mkstemp(&tmp[0]);
+            if (fd < 0)
+                throw SnapshotError("can't create a temporary file for " + path);
+            // mkstemp creates the file for the owner only
+            bool ok = ::fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0;
+            for (size_t done = 0; ok && done < data.size(); ) {
+                ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                ok = n > 0;
+                if (ok)
+                    done += static_cast<size_t>(n);
+            }
+            ok = ok && ::fsync(fd) == 0;
+            ok = ::close(fd) == 0 && ok;
+            if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+                ::unlink(tmp.c_str());
+                throw SnapshotError("can't write " + path);
+            }
+            size_t slash = path.rfind('/');
+            std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            int dfd = ::open(dir.c_str(), O_RDONLY);
+            if (dfd >= 0) {
+                ok = ::fsync(dfd) == 0;
+                ::close(dfd);
+            }
+            if (dfd < 0 || !ok)
+                throw SnapshotError("can't sync the directory of " + path);
+#else
+            static std::atomic<unsigned> counter(0);
+            std::string tmp = path + ".tmp" + std::to_string(counter++);
+            std::FILE* f = std::fopen(tmp.c_str(), "wb");
+            if (!f)
+                throw SnapshotError("can't create " + tmp);
+            bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+            ok = std::fflush(f) == 0 && ok;
+            ok = std::fclose(f) == 0 && ok;
+            if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+                std::remove(tmp.c_str());
+                throw SnapshotError("can't write " + path);
+            }
+#endif
+        }
+
+        // read only view of a whole file, mapped when the platform allows it
+        class FileView {
+            const char* data_;
+            size_t size_;
+            std::vector<char> buffer_;
+            bool mapped_;
+        public:
+            explicit FileView(const std::string& path) : data_(nullptr), size_(0), mapped_(false) {
+#ifdef LRU_SNAPSHOT_MMAP
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw SnapshotError("can't open " + path);
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw SnapshotError("can't stat " + path);
+                }
+                size_ = static_cast<size_t>(st.st_size);
+                if (size_ > 0) {
+                    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (p == MAP_FAILED) {
+                        ::close(fd);
+                        throw SnapshotError("can't map " + path);
+                    }
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(p);
+                    mapped_ = true;
+                }
+                ::close(fd);
+#else
+                std::FILE* f = std::fopen(path.c_str(), "rb");
+                if (!f)
+                    throw SnapshotError("can't open " + path);
+                char chunk[1 << 16];
+                size_t n;
+                while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0)
+                    buffer_.insert(buffer_.end(), chunk, chunk + n);
+                std::fclose(f);
+                data_ = buffer_.data();
+                size_ = buffer_.size();
+#endif
+            }
+            ~FileView() {
+#ifdef LRU_SNAPSHOT_MMAP
+                if (mapped_)
+                    ::munmap(const_cast<char*>(data_), size_);
+#endif
+            }
+            FileView(const FileView&) = delete;
+            FileView& operator=(const FileView&) = delete;
+            const char* data() const { return data_; }
+            size_t size() const { return size_; }
+        };
+    }
+
+    /**
+     * writes the entries of cache with their sizes to path, in the order of its policy
+     * The entries are encoded under the read lock of the cache and written after it is released,
+     * to a temporary file synced to disk and renamed to path once complete, so neither a crash
+     * nor a power loss leaves a torn snapshot at path.
+     * Works with every cache providing cwalk() (LRUCache, ShardedLRUCache, IntrusiveLRUCache...).
+     * returns the number of entries written
+     */
+    template <class Cache,
+    class KeyCodec = Codec<typename std::decay<decltype(std::declval<typename Cache::node_type>().key)>::type>,
+    class ValueCodec = Codec<typename std::decay<decltype(std::declval<typename Cache::node_type>().value)>::type>>
+    size_t saveSnapshot(const Cache& cache, const std::string& path) {
+        using namespace snapshot_detail;
+        std::string out(kHeaderSize, '\0');
+        std::uint64_t count = 0;
+        std::string field;
+        auto encode = [&] (const typename Cache::node_type& n) {
+            field.clear();
+            KeyCodec::encode(n.key, field);
+            putLength(out, field.size());
+            out.append(field);
+            field.clear();
+            ValueCodec::encode(n.value, field);
+            putLength(out, field.size());
+            out.append(field);
+            put<std::uint64_t>(out, n.size);
+            count++;
+        };
+        cache.cwalk(encode);
+        std::memcpy(&out[0], kMagic, 4);
+        std::memcpy(&out[4], &kVersion, 4);
+        std::memcpy(&out[8], &count, 8);
+
+        writeAtomically(path, out);
+        return static_cast<size_t>(count);
+    }
+
+    /**
+     * inserts the entries saved in path into cache, keeping their order: the entry that was the
+     * most recently used one when saved is again the most recently used one.
+     * The file is mapped in memory, the records are located in one pass over their lengths and
+     * decoded by threads workers (default: the number of cores) in parallel, then inserted in
+     * batches with insertMany(), which a ShardedLRUCache spreads over its shards.
+     * If the cache is smaller than the snapshot the least recently used entries are evicted.
+     * returns the number of entries read
+     */
+    template <class Cache,
+    class KeyCodec = Codec<typename std::decay<decltype(std::declval<typename Cache::node_type>().key)>::type>,
+    class ValueCodec = Codec<typename std::decay<decltype(std::declval<typename Cache::node_type>().value)>::type>>
+    size_t loadSnapshot(Cache& cache, const std::string& path, unsigned threads = 0) {
+        using namespace snapshot_detail;
+        typedef typename std::decay<decltype(std::declval<typename Cache::node_type>().key)>::type key_type;
+        typedef typename std::decay<decltype(std::declval<typename Cache::node_type>().value)>::type value_type;
+        typedef std::tuple<key_type, value_type, size_t> entry_type;
+
+        FileView file(path);
+        const char* data = file.data();
+        const size_t size = file.size();
+        if (size < kHeaderSize || std::memcmp(data, kMagic, 4) != 0)
+            throw SnapshotError(path + " is not a snapshot");
+        if (get<std::uint32_t>(data + 4) != kVersion)
+            throw SnapshotError(path + " has an unknown version");
+        std::uint64_t count = get<std::uint64_t>(data + 8);
+
+        // the offset of every record, checked against the end of the file
+        std::vector<size_t> offsets;
+        offsets.reserve(static_cast<size_t>(std::min<std::uint64_t>(count, size / 16)));
+        size_t pos = kHeaderSize;
+        for (std::uint64_t i = 0; i < count; i++) {
+            offsets.push_back(pos);
+            for (int field = 0; field < 2; field++) {
+                if (size - pos < 4)
+                    throw SnapshotError(path + " is truncated");
+                size_t n = get<std::uint32_t>(data + pos);
+                if (size - pos - 4 < n)
+                    throw SnapshotError(path + " is truncated");
+                pos += 4 + n;
+            }
+            if (size - pos < 8)
+                throw SnapshotError(path + " is truncated");
+            pos += 8;
+        }
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        // a worker per 4096 records at most, small snapshots are decoded inline
+        threads = static_cast<unsigned>(std::min<size_t>(threads, offsets.size() / 4096 + 1));
+        std::vector<std::vector<entry_type>> chunks(threads);
+        std::vector<std::exception_ptr> errors(threads);
+        auto decode = [&] (unsigned t) {
+            try {
+                size_t first = offsets.size() * t / threads;
+                size_t last = offsets.size() * (t + 1) / threads;
+                chunks[t].reserve(last - first);
+                for (size_t i = first; i < last; i++) {
+                    const char* p = data + offsets[i];
+                    size_t kn = get<std::uint32_t>(p);
+                    const char* k = p + 4;
+                    size_t vn = get<std::uint32_t>(k + kn);
+                    const char* v = k + kn + 4;
+                    size_t s = static_cast<size_t>(get<std::uint64_t>(v + vn));
+                    chunks[t].emplace_back(KeyCodec::decode(k, kn), ValueCodec::decode(v, vn), s);
+                }
+            }
+            catch (...) {
+                errors[t] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; t++)
+            workers.emplace_back(decode, t);
+        decode(0);
+        for (auto& w : workers)
+            w.join();
+        for (auto& e : errors) {
+            if (e)
+                std::rethrow_exception(e);
+        }
+
+        // least recently used first, so that the most recent entry ends up in front
+        for (size_t t = threads; t-- > 0; ) {
+            auto& chunk = chunks[t];
+            cache.insertMany(std::make_move_iterator(chunk.rbegin()), std::make_move_iterator(chunk.rend()));
+            std::vector<entry_type>().swap(chunk);
+        }
+        return offsets.size();
+    }
+}
+#endif // LRU_SNAPSHOT_HPP
@@ -0,0 +1,327 @@
+/* @file TieredLRUCache.hpp*/
+#ifndef TIERED_LRU_CACHE_HPP
+#define TIERED_LRU_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "LRUCache.hpp"
+#include "Snapshot.hpp"
+#include "../bzip2/bzlib.h"
+
+namespace lru {
+
+    /**
+     * A Compressor turns the encoded bytes of a value into the bytes kept by the spill tier
+     * and back:
+     *        bool compress(const std::string& in, std::string& out)
+     *        bool decompress(const std::string& in, std::string& out)
+     * Both return false when they fail, the entry is then dropped.
+     */
+
+    /**
+     * keeps the bytes as they are, for values that don't compress or as a fast default
+     */
+    struct NullCompressor {
+        bool compress(const std::string& in, std::string& out) const {
+            out = in;
+            return true;
+        }
+        bool decompress(const std::string& in, std::string& out) const {
+            out = in;
+            return true;
+        }
+    };
+
+    /**
+     * bzip2 with blocks of BlockSize100k * 100k bytes (1 to 9)
+     * The compressed bytes are prefixed with the length of the input, which sizes the output
+     * buffer of BZ2_bzBuffToBuffDecompress(). bzip2 takes 32 bit lengths, compress() fails on
+     * larger inputs. Needs the sources of bzip2/ to be linked in.
+     */
+    template <int BlockSize100k = 1>
+    struct Bzip2Compressor {
+        bool compress(const std::string& in, std::string& out) const {
+            // the worst case documented by bzip2: 1% larger than the input plus 600 bytes
+            std::uint64_t bound = static_cast<std::uint64_t>(in.size()) + in.size() / 100 + 600;
+            if (bound > std::numeric_limits<unsigned int>::max())
+                return false;
+            std::uint32_t n = static_cast<std::uint32_t>(in.size());
+            unsigned int len = static_cast<unsigned int>(bound);
+            out.resize(4 + len);
+            std::memcpy(&out[0], &n, 4);
+            if (BZ2_bzBuffToBuffCompress(&out[4], &len, const_cast<char*>(in.data()), n,
+                                         BlockSize100k, 0, 0) != BZ_OK)
+                return false;
+            out.resize(4 + len);
+            return true;
+        }
+        bool decompress(const std::string& in, std::string& out) const {
+            std::uint32_t n;
+            if (in.size() < 4)
+                return false;
+            std::memcpy(&n, in.data(), 4);
+            if (n == std::numeric_limits<std::uint32_t>::max())
+                return false;
+            // one spare byte, bzip2 refuses an empty output buffer
+            out.resize(n + 1);
+            unsigned int len = n + 1;
+            if (BZ2_bzBuffToBuffDecompress(&out[0], &len, const_cast<char*>(in.data()) + 4,
+                                           static_cast<unsigned int>(in.size() - 4), 0, 0) != BZ_OK || len != n)
+                return false;
+            out.resize(n);
+            return true;
+        }
+    };
+
+    /**
+     * The TieredLRUCache class templated by
+     *        Key - key type
+     *        Value - value type
+     *        Lock - a lock type like std::mutex (default: NullLock = no synchronization)
+     *        Compressor - compresses the values of the spill tier (default: Bzip2Compressor)
+     *        ValueCodec - encodes the values to bytes, see Snapshot.hpp (default: Codec<Value>)
+     *        Policy - the eviction policy of the first tier
+     *
+     * An LRUCache whose evicted entries are not lost but compressed into a second, spill tier
+     * bounded by the bytes it holds. A get() missing the first tier looks the key up in the
+     * spill tier and, if found, decompresses the value and inserts it back into the first tier,
+     * which may in turn spill its least recently used entry. The spill tier is itself an LRU,
+     * the entries it evicts are dropped. Compressible values get several times the capacity of
+     * the first tier for the price of a decompression on the hits of the second one.
+     * Both tiers are guarded by the lock of the TieredLRUCache.
+     */
+    template <class Key, class Value, class Lock = NullLock,
+    class Compressor = Bzip2Compressor<>, class ValueCodec = Codec<Value>,
+    template <typename, typename> class Policy = LRUPolicy>
+    class TieredLRUCache {
+
+    public:
+        typedef Lock lock_type;
+        using Guard = std::lock_guard<lock_type>;
+
+        /**
+         * an entry of the spill tier: the compressed bytes of the value and its size in the
+         * first tier
+         */
+        struct Spilled {
+            std::string bytes;
+            size_t size;
+        };
+        typedef LRUCache<Key, Value, NullLock, LRUMap<Key, Value>, Policy> cache_type;
+        typedef LRUCache<Key, Spilled> spill_type;
+        typedef typename cache_type::node_type node_type;
+    private:
+        // Dissallow copying.
+        TieredLRUCache(const TieredLRUCache&) = delete;
+        TieredLRUCache& operator=(const TieredLRUCache&) = delete;
+
+        mutable Lock lock_;
+        Compressor compressor_;
+        spill_type spill_;
+        size_t spillSize_;
+        // cleared while entries are removed on purpose, only evicted entries are spilled
+        bool spilling_;
+        std::string buffer_;
+        size_t spillHits_;
+        cache_type cache_;
+
+        // the remove callback of the first tier, runs with lock_ held
+        void spill(node_type&& n) {
+            if (!spilling_ || spillSize_ == 0)
+                return;
+            try {
+                buffer_.clear();
+                ValueCodec::encode(n.value, buffer_);
+                Spilled s;
+                s.size = n.size;
+                if (!compressor_.compress(buffer_, s.bytes))
+                    return;
+                size_t bytes = s.bytes.size();
+                spill_.insert(std::move(n.key), std::move(s), bytes);
+            }
+            catch (...) {
+                // larger than the whole spill tier or out of memory: the entry is dropped
+            }
+        }
+
+        // must be called with lock_ held, moves k from the spill tier back to the first tier
+        // The spilled copy is kept until the value is in the first tier, a decode or an insert
+        // that throws (TooLargeSize after updateSize()) leaves it where it was.
+        bool unspillLocked(const Key& k) {
+            if (!spill_.contains(k))
+                return false;
+            const Spilled& s = spill_.peek(k);
+            size_t size = s.size;
+            buffer_.clear();
+            if (!compressor_.decompress(s.bytes, buffer_)) {
+                spill_.remove(k);
+                return false;
+            }
+            cache_.insert(k, ValueCodec::decode(buffer_.data(), buffer_.size()), size);
+            // refused by the policy of the first tier, k was spilled again over its old copy
+            if (cache_.contains(k))
+                spill_.remove(k);
+            spillHits_++;
+            return true;
+        }
+
+        // must be called with lock_ held
+        const Value* findLocked(const Key& k) {
+            if (cache_.contains(k))
+                return &cache_.get(k);
+            // the policy of the first tier may refuse the entry and spill it again right away
+            if (unspillLocked(k) && cache_.contains(k))
+                return &cache_.peek(k);
+            return nullptr;
+        }
+
+    public:
+        /**
+         * maxSize and elasticity as in LRUCache for the first tier
+         * spillSize is the number of compressed bytes the spill tier holds at most (0: no spill tier)
+         */
+        explicit TieredLRUCache(size_t maxSize, size_t elasticity, size_t spillSize,
+        Compressor compressor = Compressor())
+        : compressor_(compressor), spill_(spillSize, 0), spillSize_(spillSize), spilling_(true),
+          spillHits_(0),
+          cache_(maxSize, elasticity, nullptr, [this] (void*, node_type&& n) { spill(std::move(n)); }) {}
+
+        virtual ~TieredLRUCache() = default;
+
+        void updateSize(size_t maxSize, size_t elasticity) {
+            Guard g(lock_);
+            cache_.updateSize(maxSize, elasticity);
+        }
+
+        void updateSpillSize(size_t spillSize) {
+            Guard g(lock_);
+            spillSize_ = spillSize;
+            spill_.updateSize(spillSize, 0);
+            if (spillSize == 0)
+                spill_.clear();
+        }
+
+        /**
+         * the size of the entries of the first tier
+         */
+        size_t size() const {
+            Guard g(lock_);
+            return cache_.size();
+        }
+
+        /**
+         * the compressed bytes held by the spill tier
+         */
+        size_t spilledSize() const {
+            Guard g(lock_);
+            return spill_.size();
+        }
+
+        /**
+         * the number of get() served by the spill tier
+         */
+        size_t spillHits() const {
+            Guard g(lock_);
+            return spillHits_;
+        }
+
+        bool empty() const {
+            Guard g(lock_);
+            return cache_.empty() && spill_.empty();
+        }
+
+        void clear() {
+            Guard g(lock_);
+            cache_.clear();
+            spill_.clear();
+        }
+
+        /**
+         * inserts or replaces the value of k in the first tier, dropping a spilled older value
+         * This function throws TooLargeSize when s doesn't fit in the first tier
+         */
+        template <class V = Value>
+        void insert(const Key& k, V&& v, const size_t & s) {
+            Guard g(lock_);
+            spill_.remove(k);
+            cache_.insert(k, std::forward<V>(v), s);
+        }
+
+        /**
+         * This function throws KeyNotFound
+         * The const reference returned here is only
+         * guaranteed to be valid till the next insert/delete
+         */
+        const Value& get(const Key& k) {
+            Guard g(lock_);
+            const Value* v = findLocked(k);
+            if (!v)
+                throw KeyNotFound();
+            return *v;
+        }
+
+        Value getCopy(const Key& k) {
+            Guard g(lock_);
+            const Value* v = findLocked(k);
+            if (!v)
+                throw KeyNotFound();
+            return *v;
+        }
+
+        bool getCopy(const Key& k, Value& v) {
+            Guard g(lock_);
+            const Value* found = findLocked(k);
+            if (!found)
+                return false;
+            v = *found;
+            return true;
+        }
+
+        /**
+         * removes k from both tiers
+         */
+        bool remove(const Key& k) {
+            Guard g(lock_);
+            spilling_ = false;
+            bool removed = cache_.remove(k);
+            spilling_ = true;
+            return spill_.remove(k) || removed;
+        }
+
+        /**
+         * true if k is in either tier, nothing is promoted or decompressed
+         */
+        bool contains(const Key& k) const {
+            Guard g(lock_);
+            return cache_.contains(k) || spill_.contains(k);
+        }
+
+        /**
+         * true if k is in the first tier
+         */
+        bool resident(const Key& k) const {
+            Guard g(lock_);
+            return cache_.contains(k);
+        }
+
+        size_t getMaxSize() const { return cache_.getMaxSize(); }
+        size_t getElasticity() const { return cache_.getElasticity(); }
+        size_t getMaxAllowedSize() const { return cache_.getMaxAllowedSize(); }
+        size_t getSpillSize() const { return spillSize_; }
+
+        /**
+         * walks the entries of the first tier
+         */
+        template <typename F>
+        void cwalk(F& f) const {
+            Guard g(lock_);
+            cache_.cwalk(f);
+        }
+    };
+}
+#endif // TIERED_LRU_CACHE_HPP
@@ -0,0 +1,174 @@
+/* @file TimerWheel.hpp*/
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace lru {
+
+    /**
+     * Hierarchical timing wheel (Varghese, Lauck - SOSP 1987) holding items of type T with a
+     * deadline expressed in ticks.
+     * Level L has 64 slots of 64^L ticks each, so 4 levels cover 2^24 ticks; later deadlines wait
+     * in an overflow list. schedule() is O(1). advance() fires the items of every tick it passes
+     * and, each time a lower level wraps around, cascades the next slot of the level above down.
+     * Every item is moved at most once per level, which makes expiration amortized O(1).
+     * A bitmap per level marks the occupied slots, so advance() jumps from one occupied slot to
+     * the next: its cost follows the slots holding items, not the number of ticks elapsed.
+     */
+    template <class T>
+    class TimerWheel {
+    public:
+        static constexpr unsigned kBits = 6;
+        static constexpr unsigned kSlots = 1u << kBits;
+        static constexpr unsigned kLevels = 4;
+        typedef std::pair<std::uint64_t, T> item_type; // deadline, item
+    private:
+        std::vector<item_type> slots_[kLevels][kSlots];
+        std::uint64_t occupied_[kLevels]; // bit s set if slots_[level][s] holds items
+        std::vector<item_type> overflow_;
+        std::vector<item_type> due_; // items being fired, kept to reuse its capacity
+        std::uint64_t now_;
+        size_t size_;
+
+        // earliest is the first tick whose level 0 slot has not been fired yet
+        void place(item_type&& item, std::uint64_t earliest) {
+            std::uint64_t deadline = item.first;
+            if (deadline < earliest)
+                deadline = earliest;
+            std::uint64_t delta = deadline - now_;
+            for (unsigned level = 0; level < kLevels; level++) {
+                if (delta < (std::uint64_t(1) << (kBits * (level + 1)))) {
+                    size_t slot = (deadline >> (kBits * level)) & (kSlots - 1);
+                    slots_[level][slot].push_back(std::move(item));
+                    occupied_[level] |= std::uint64_t(1) << slot;
+                    return;
+                }
+            }
+            overflow_.push_back(std::move(item));
+        }
+
+        // moves the items of a slot of a higher level to the levels below
+        void cascade(unsigned level) {
+            size_t slot = (now_ >> (kBits * level)) & (kSlots - 1);
+            if (!(occupied_[level] & (std::uint64_t(1) << slot)))
+                return;
+            occupied_[level] &= ~(std::uint64_t(1) << slot);
+            std::vector<item_type> items;
+            items.swap(slots_[level][slot]);
+            // the slot of the current tick is fired right after cascading
+            for (auto& item : items)
+                place(std::move(item), now_);
+        }
+
+        void cascadeOverflow() {
+            std::vector<item_type> items;
+            items.swap(overflow_);
+            // the slot of the current tick is fired right after cascading
+            for (auto& item : items)
+                place(std::move(item), now_);
+        }
+
+        static unsigned lowestBit(std::uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctzll(bits));
+#else
+            unsigned i = 0;
+            while (!(bits & 1)) {
+                bits >>= 1;
+                i++;
+            }
+            return i;
+#endif
+        }
+
+        // the first tick after now_ at which a slot of level holding items is reached
+        // (fired for level 0, cascaded above), or UINT64_MAX if the level is empty
+        std::uint64_t nextTick(unsigned level) const {
+            std::uint64_t bits = occupied_[level];
+            if (!bits)
+                return UINT64_MAX;
+            std::uint64_t index = (now_ >> (kBits * level)) + 1;
+            unsigned from = static_cast<unsigned>(index & (kSlots - 1));
+            // rotate so that bit 0 is the slot of index
+            std::uint64_t rotated = from ? (bits >> from) | (bits << (kSlots - from)) : bits;
+            return (index + lowestBit(rotated)) << (kBits * level);
+        }
+
+    public:
+        explicit TimerWheel(std::uint64_t now = 0) : occupied_(), now_(now), size_(0) {}
+
+        /**
+         * the tick the wheel has advanced to
+         */
+        std::uint64_t now() const { return now_; }
+
+        size_t size() const { return size_; }
+
+        bool empty() const { return size_ == 0; }
+
+        /**
+         * adds item to fire at deadline, a deadline not after now() fires on the next advance
+         */
+        void schedule(T item, std::uint64_t deadline) {
+            // already due items fire on the next tick
+            place(item_type(deadline, std::move(item)), now_ + 1);
+            size_++;
+        }
+
+        /**
+         * moves the wheel to tick and calls expire(deadline, item) for every item due by then
+         * returns the number of items fired
+         */
+        template <typename F>
+        size_t advance(std::uint64_t tick, F&& expire) {
+            size_t fired = 0;
+            while (now_ < tick) {
+                // skip the ticks at which no slot is fired or cascaded
+                std::uint64_t next = UINT64_MAX;
+                for (unsigned level = 0; level < kLevels; level++)
+                    next = std::min(next, nextTick(level));
+                if (!overflow_.empty())
+                    next = std::min(next, ((now_ >> (kBits * kLevels)) + 1) << (kBits * kLevels));
+                if (next > tick) {
+                    now_ = tick;
+                    break;
+                }
+                now_ = next;
+                // a wrap of level L-1 brings the next slot of level L down
+                for (unsigned level = 1; level < kLevels; level++) {
+                    if (now_ & ((std::uint64_t(1) << (kBits * level)) - 1))
+                        break;
+                    cascade(level);
+                    if (level == kLevels - 1 && !(now_ & ((std::uint64_t(1) << (kBits * kLevels)) - 1)))
+                        cascadeOverflow();
+                }
+                size_t slot = now_ & (kSlots - 1);
+                occupied_[0] &= ~(std::uint64_t(1) << slot);
+                due_.swap(slots_[0][slot]);
+                for (auto& item : due_) {
+                    size_--;
+                    fired++;
+                    expire(item.first, std::move(item.second));
+                }
+                due_.clear();
+            }
+            return fired;
+        }
+
+        void clear() {
+            for (auto& level : slots_)
+                for (auto& slot : level)
+                    slot.clear();
+            for (auto& bits : occupied_)
+                bits = 0;
+            overflow_.clear();
+            size_ = 0;
+        }
+    };
+}
+#endif // TIMER_WHEEL_HPP
@@ -0,0 +1,88 @@
+//  indexStack.h
+//  Cpp-Fundamentals
+
+#ifndef IndexStack_h
+#define IndexStack_h
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free LIFO (Treiber stack) of 32 bit indices into an array owned by the caller, which
+// also provides the link of every index: Links is an array of std::atomic<std::uint32_t> or
+// anything whose operator[] maps an index to its link. The head packs the top index with a
+// generation bumped by every push and pop in a single 64 bit word, so a pop whose head changed
+// and changed back meanwhile (ABA) fails its compare-and-swap instead of linking a stale next.
+// An index may only be pushed by the thread that owns it, i.e. that popped it or never
+// pushed it yet.
+template <class Links = std::atomic<std::uint32_t>*>
+class IndexStack
+{
+private:
+    std::atomic<std::uint64_t>   m_ullHead; //Generation in the high half, top index in the low half.
+    Links                        m_Next;    //Link of every index, kNil ends the stack.
+
+    // Dissallow copying.
+    IndexStack(const IndexStack&) = delete;
+    IndexStack& operator=(const IndexStack&) = delete;
+
+    static std::uint64_t Pack(std::uint64_t ullOld, std::uint32_t uIndex)
+    {
+        return ((ullOld >> 32) + 1) << 32 | uIndex;
+    }
+
+public:
+    static const std::uint32_t kNil = 0xFFFFFFFFu;
+
+    explicit IndexStack(Links next):
+            m_ullHead(kNil),
+            m_Next(next)
+    {
+    }
+
+    void Push(std::uint32_t uIndex)
+    {
+        PushChain(uIndex, uIndex);
+    }
+
+    // Pushes the indices linked from uFirst to uLast at once, uFirst ends on top.
+    void PushChain(std::uint32_t uFirst, std::uint32_t uLast)
+    {
+        std::uint64_t ullOld = m_ullHead.load(std::memory_order_relaxed);
+        do
+        {
+            m_Next[uLast].store((std::uint32_t)ullOld, std::memory_order_relaxed);
+        }
+        while(!m_ullHead.compare_exchange_weak(ullOld, Pack(ullOld, uFirst),
+                                               std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Returns false if the stack is empty.
+    bool Pop(std::uint32_t& uIndex)
+    {
+        std::uint64_t ullOld = m_ullHead.load(std::memory_order_acquire);
+        for(;;)
+        {
+            std::uint32_t uTop = (std::uint32_t)ullOld;
+            if(kNil == uTop)
+            {
+                return false;
+            }
+            // May read the link of an index popped and pushed again meanwhile, the generation
+            // then makes the compare-and-swap fail.
+            std::uint32_t uNext = m_Next[uTop].load(std::memory_order_relaxed);
+            if(m_ullHead.compare_exchange_weak(ullOld, Pack(ullOld, uNext),
+                                               std::memory_order_acquire, std::memory_order_acquire))
+            {
+                uIndex = uTop;
+                return true;
+            }
+        }
+    }
+
+    bool Empty() const
+    {
+        return kNil == (std::uint32_t)m_ullHead.load(std::memory_order_relaxed);
+    }
+};
+
+#endif /* IndexStack_h */
@@ -0,0 +1,198 @@
+//  lockFreeMemPool.h
+//  Cpp-Fundamentals
+
+#ifndef LockFreeMemPool_h
+#define LockFreeMemPool_h
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <new>
+
+#include "indexStack.h"
+
+// Thread-safe MemPool without a mutex on Alloc and Free: the free units form a lock-free
+// IndexStack, so any thread may free a unit allocated by another one (producer / consumer
+// queues, work stealing). A unit is named by a 32 bit index, its chunk in the high bits and its
+// position in the chunk in the low kUnitBits, which leaves room for the generation counter
+// against ABA in the 64 bit head of the stack. The links of the free list are kept in an array
+// beside every chunk rather than in the units, so a thread reading the link of a unit another
+// thread just allocated reads an atomic instead of the user's bytes.
+// Like MemPool it grows by chunks twice as large as the previous one (up to 64MB), the growth
+// alone is serialized by a mutex. Requests larger than the unit size, and those arriving once
+// kMaxChunks chunks are in use, are served by malloc.
+class LockFreeMemPool
+{
+public:
+    static const unsigned kUnitBits = 26;
+    static const unsigned kMaxChunks = 63; //Chunk 64 would hold the index IndexStack ends with.
+
+private:
+    static const std::uint32_t kUnitMask = (1u << kUnitBits) - 1;
+
+    struct _Chunk //A memory block the units are carved from, never changed once published.
+    {
+        char *pBegin, *pEnd;
+        std::atomic<std::uint32_t>* pNext; //Free list link of every unit of the chunk.
+    };
+
+    struct _Links //Maps the index of a unit to its link for the IndexStack.
+    {
+        const struct _Chunk* pChunks;
+        std::atomic<std::uint32_t>& operator[](std::uint32_t uIndex) const
+        {
+            return pChunks[uIndex >> kUnitBits].pNext[uIndex & kUnitMask];
+        }
+    };
+
+    struct _Chunk                 m_aChunks[kMaxChunks];
+    std::atomic<unsigned>         m_uChunkCount; //Chunks published in m_aChunks.
+    IndexStack<struct _Links>     m_FreeUnits;   //Free linkedlist of unit indices.
+
+    unsigned long    m_ulUnitSize; //Memory unit size.
+    unsigned long    m_ulUnitStride; //Distance between two units, the unit size rounded up to a pointer.
+
+    std::mutex       m_GrowMutex; //Serializes Grow().
+    unsigned long    m_ulNextUnitNum; //Number of units of the next chunk, guarded by m_GrowMutex.
+
+    // Dissallow copying.
+    LockFreeMemPool(const LockFreeMemPool&) = delete;
+    LockFreeMemPool& operator=(const LockFreeMemPool&) = delete;
+
+    static unsigned long UnitStride(unsigned long ulUnitSize)
+    {
+        unsigned long ulSize = ulUnitSize ? ulUnitSize : 1;
+        return (ulSize + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+    }
+
+    static bool InChunk(const struct _Chunk& chunk, void* p)
+    {
+        return !std::less<char *>()((char *)p, chunk.pBegin) && std::less<char *>()((char *)p, chunk.pEnd);
+    }
+
+    // Allocate a chunk of m_ulNextUnitNum units and push them on the free list. Threads
+    // finding the free list empty at once all wait here, the ones after the first return
+    // without growing once it has pushed its units.
+    bool Grow()
+    {
+        const unsigned long ulMaxChunkSize = 64ul << 20;
+        std::lock_guard<std::mutex> g(m_GrowMutex);
+        if(false == m_FreeUnits.Empty())
+        {
+            return true;
+        }
+        unsigned uChunk = m_uChunkCount.load(std::memory_order_relaxed);
+        if(kMaxChunks == uChunk)
+        {
+            return false;
+        }
+        unsigned long ulMaxChunkUnits = ulMaxChunkSize / m_ulUnitStride ? ulMaxChunkSize / m_ulUnitStride : 1;
+        if(ulMaxChunkUnits > kUnitMask + 1ul)
+        {
+            ulMaxChunkUnits = kUnitMask + 1ul;
+        }
+        unsigned long ulUnitNum = m_ulNextUnitNum;
+        if(ulUnitNum > ULONG_MAX / m_ulUnitStride) //The size of the block would overflow.
+        {
+            return false;
+        }
+        char* pBlock = (char *)malloc(ulUnitNum * m_ulUnitStride); //Allocate a memory block.
+        std::atomic<std::uint32_t>* pNext =
+            (std::atomic<std::uint32_t>*)malloc(ulUnitNum * sizeof(std::atomic<std::uint32_t>));
+        if(nullptr == pBlock || nullptr == pNext)
+        {
+            free(pBlock);
+            free(pNext);
+            return false;
+        }
+        // Double the next chunk, clamped to ulMaxChunkSize and to the units an index can name.
+        m_ulNextUnitNum = ulUnitNum < ulMaxChunkUnits / 2 ? ulUnitNum * 2 : ulMaxChunkUnits;
+
+        // Link all mem unit in address order, the chain is pushed at once.
+        std::uint32_t uFirst = (std::uint32_t)uChunk << kUnitBits;
+        for(unsigned long i=0; i<ulUnitNum; i++)
+        {
+            new (&pNext[i]) std::atomic<std::uint32_t>(uFirst + (std::uint32_t)i + 1);
+        }
+        struct _Chunk chunk = { pBlock, pBlock + ulUnitNum * m_ulUnitStride, pNext };
+        m_aChunks[uChunk] = chunk;
+        m_uChunkCount.store(uChunk + 1, std::memory_order_release);
+        m_FreeUnits.PushChain(uFirst, uFirst + (std::uint32_t)ulUnitNum - 1);
+        return true;
+    }
+
+public:
+
+    // ulUnitNum units are allocated upfront.
+    LockFreeMemPool(unsigned long ulUnitNum,
+                    unsigned long ulUnitSize /* Recommended 2**n */):
+            m_uChunkCount(0),
+            m_FreeUnits(_Links{ m_aChunks }),
+            m_ulUnitSize(ulUnitSize),
+            m_ulUnitStride(UnitStride(ulUnitSize)),
+            m_ulNextUnitNum(ulUnitNum ? (ulUnitNum <= kUnitMask + 1ul ? ulUnitNum : kUnitMask + 1ul) : 16)
+    {
+        if(ulUnitNum > 0)
+        {
+            Grow();
+        }
+    }
+
+    // The units still allocated are released too.
+    ~LockFreeMemPool()
+    {
+        unsigned uCount = m_uChunkCount.load(std::memory_order_acquire);
+        for(unsigned i=0; i<uCount; i++)
+        {
+            free(m_aChunks[i].pBegin);
+            free(m_aChunks[i].pNext);
+        }
+    }
+
+    // Number of memory blocks the units are carved from.
+    unsigned long ChunkCount() const
+    {
+        return m_uChunkCount.load(std::memory_order_acquire);
+    }
+
+    // Safe from any thread. Requests larger than the unit size go to malloc.
+    void* Alloc(unsigned long ulSize)
+    {
+        if(ulSize > m_ulUnitSize)
+        {
+            return malloc(ulSize);
+        }
+        std::uint32_t uIndex;
+        while(false == m_FreeUnits.Pop(uIndex))
+        {
+            if(false == Grow())
+            {
+                return malloc(ulSize);
+            }
+        }
+        return m_aChunks[uIndex >> kUnitBits].pBegin + (uIndex & kUnitMask) * m_ulUnitStride;
+    }
+
+    // Safe from any thread, whichever thread allocated p. The chunks are searched from the
+    // latest, the largest one, and p goes to free if none holds it.
+    void Free(void* p)
+    {
+        unsigned uCount = m_uChunkCount.load(std::memory_order_acquire);
+        for(unsigned i=uCount; i-- > 0; )
+        {
+            if(InChunk(m_aChunks[i], p))
+            {
+                unsigned long ulUnit = (unsigned long)((char *)p - m_aChunks[i].pBegin) / m_ulUnitStride;
+                m_FreeUnits.Push(((std::uint32_t)i << kUnitBits) | (std::uint32_t)ulUnit);
+                return;
+            }
+        }
+        free(p);
+    }
+
+};
+
+#endif /* LockFreeMemPool_h */
@@ -4,64 +4,173 @@
 #ifndef MemPool_h
 #define MemPool_h
 
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+// Build with MEMPOOL_DEBUG defined to put a header in front of every unit and keep the
+// allocated units in a doubly linked list, to inspect them from a debugger. Without it units
+// carry no header: a free unit holds the link of the free list in its own bytes.
+// When all units are in use the pool grows by a new chunk twice as large as the previous one
+// (up to 64MB), so that only requests larger than the unit size go to the system allocator.
 class MemPool
 {
 private:
     // The purpose of the structure`s definition is that we can operate linkedlist conveniently
-    struct _Unit //The type of the node of linkedlist.
+    struct _Unit //The type of the node of the free linkedlist, stored inside the free unit.
+    {
+        struct _Unit *pNext;
+    };
+
+#ifdef MEMPOOL_DEBUG
+    struct _Header //The type of the node of the allocated linkedlist, stored in front of the unit.
+    {
+        struct _Header *pPrev, *pNext;
+    };
+
+    struct _Header*  m_pAllocatedMemBlock; //Head pointer to Allocated linkedlist.
+#endif
+
+    struct _Chunk //A memory block the units are carved from.
     {
-        struct _Unit *pPrev, *pNext;
+        char *pBegin, *pEnd;
     };
 
-    void* m_pMemBlock;                //The address of memory pool.
+    std::vector<struct _Chunk> m_vChunks; //The memory blocks of the pool, sorted by address.
 
-    // Manage all unit with two linkedlist.
-    struct _Unit*    m_pAllocatedMemBlock; //Head pointer to Allocated linkedlist.
     struct _Unit*    m_pFreeMemBlock;      //Head pointer to Free linkedlist.
 
     unsigned long    m_ulUnitSize; //Memory unit size. There are much unit in memory pool.
-    unsigned long    m_ulBlockSize; //Memory pool size. Memory pool is make of memory unit.
+    unsigned long    m_ulUnitStride; //Distance between two units, the unit size rounded up to hold a pointer.
+    unsigned long    m_ulNextUnitNum; //Number of units of the next chunk.
+    bool             m_bGrowable; //Add chunks when all units are in use, or fall back to malloc.
+    unsigned long    m_ulLastChunk; //Index of the chunk found by the last Free.
+
+    // Dissallow copying.
+    MemPool(const MemPool&) = delete;
+    MemPool& operator=(const MemPool&) = delete;
+
+    static unsigned long HeaderSize()
+    {
+#ifdef MEMPOOL_DEBUG
+        return sizeof(struct _Header);
+#else
+        return 0;
+#endif
+    }
+
+    static unsigned long UnitStride(unsigned long ulUnitSize)
+    {
+        unsigned long ulSize = ulUnitSize < sizeof(struct _Unit) ? sizeof(struct _Unit) : ulUnitSize;
+        return HeaderSize() + (ulSize + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+    }
+
+    // Allocate a chunk of m_ulNextUnitNum units and link them into the free list.
+    bool Grow()
+    {
+        const unsigned long ulMaxChunkSize = 64ul << 20;
+        const unsigned long ulMaxChunkUnits = ulMaxChunkSize / m_ulUnitStride ? ulMaxChunkSize / m_ulUnitStride : 1;
+        unsigned long ulUnitNum = m_ulNextUnitNum;
+        if(ulUnitNum > ULONG_MAX / m_ulUnitStride) //The size of the block would overflow.
+        {
+            return false;
+        }
+        char* pBlock = (char *)malloc(ulUnitNum * m_ulUnitStride); //Allocate a memory block.
+        if(nullptr == pBlock)
+        {
+            return false;
+        }
+        struct _Chunk chunk = { pBlock, pBlock + ulUnitNum * m_ulUnitStride };
+        m_vChunks.insert(std::upper_bound(m_vChunks.begin(), m_vChunks.end(), chunk, ChunkLess), chunk);
+        // Double the next chunk, clamped to ulMaxChunkSize.
+        m_ulNextUnitNum = ulUnitNum < ulMaxChunkUnits / 2 ? ulUnitNum * 2 : ulMaxChunkUnits;
+
+        // Link all mem unit, the last one first so that the next Alloc() gets the lowest address.
+        for(unsigned long i=ulUnitNum; i-- > 0; )
+        {
+            struct _Unit *pCurUnit = (struct _Unit *)( pBlock + i*m_ulUnitStride + HeaderSize() );
+
+            pCurUnit->pNext = m_pFreeMemBlock;    //Insert the new unit at head.
+            m_pFreeMemBlock = pCurUnit;
+        }
+        return true;
+    }
+
+    static bool ChunkLess(const struct _Chunk& a, const struct _Chunk& b)
+    {
+        return std::less<char *>()(a.pBegin, b.pBegin);
+    }
+
+    static bool InChunk(const struct _Chunk& chunk, void* p)
+    {
+        return !std::less<char *>()((char *)p, chunk.pBegin) && std::less<char *>()((char *)p, chunk.pEnd);
+    }
+
+    // The chunk holding p: the one of the previous call, frees tend to come in runs from the
+    // same chunk, or a binary search. Pointers are compared with std::less since they may
+    // belong to different blocks.
+    bool Owns(void* p)
+    {
+        if(m_ulLastChunk < m_vChunks.size() && InChunk(m_vChunks[m_ulLastChunk], p))
+        {
+            return true;
+        }
+        struct _Chunk key = { (char *)p, (char *)p };
+        std::vector<struct _Chunk>::const_iterator it =
+            std::upper_bound(m_vChunks.begin(), m_vChunks.end(), key, ChunkLess);
+        if(it == m_vChunks.begin() || false == InChunk(*--it, p))
+        {
+            return false;
+        }
+        m_ulLastChunk = (unsigned long)(it - m_vChunks.begin());
+        return true;
+    }
 
 public:
-    
+
+    // ulUnitNum units are allocated upfront, bGrowable = false restores the fixed size pool
+    // that serves the requests exceeding it with malloc.
     MemPool(unsigned long ulUnitNum ,
-             unsigned long ulUnitSize /* Recommended 2**n */):
-            m_pMemBlock(nullptr),
+             unsigned long ulUnitSize /* Recommended 2**n */,
+             bool bGrowable = true):
+#ifdef MEMPOOL_DEBUG
             m_pAllocatedMemBlock(nullptr),
+#endif
             m_pFreeMemBlock(nullptr),
-            m_ulBlockSize(ulUnitNum * (ulUnitSize+sizeof(struct _Unit))),
-            m_ulUnitSize(ulUnitSize)
+            m_ulUnitSize(ulUnitSize),
+            m_ulUnitStride(UnitStride(ulUnitSize)),
+            m_ulNextUnitNum(ulUnitNum ? ulUnitNum : 16),
+            m_bGrowable(bGrowable),
+            m_ulLastChunk(0)
     {
-        m_pMemBlock = malloc(m_ulBlockSize); //Allocate a memory block.
-        if(m_pMemBlock)
+        if(ulUnitNum > 0)
         {
-            for(unsigned long i=0; i<ulUnitNum; i++)  //Link all mem unit . Create linked list.
-            {
-                struct _Unit *pCurUnit = (struct _Unit *)( (char *)m_pMemBlock + i*(ulUnitSize+sizeof(struct _Unit)) );
-                
-                pCurUnit->pPrev = nullptr;
-                pCurUnit->pNext = m_pFreeMemBlock;    //Insert the new unit at head.
-                
-                if(nullptr != m_pFreeMemBlock)
-                {
-                    m_pFreeMemBlock->pPrev = pCurUnit;
-                }
-                m_pFreeMemBlock = pCurUnit;
-            }
+            Grow();
         }
     }
-    
+
     ~MemPool()
     {
-        free(m_pMemBlock);
+        for(const struct _Chunk& chunk : m_vChunks)
+        {
+            free(chunk.pBegin);
+        }
+    }
+
+    // Number of memory blocks the units are carved from.
+    unsigned long ChunkCount() const
+    {
+        return (unsigned long)m_vChunks.size();
     }
-    
+
      // Allocate memory unit If memory pool can`t provide proper memory unit,
      // It will call system function.
     void* Alloc(unsigned long ulSize, bool bUseMemPool = true)
     {
         if( ulSize > m_ulUnitSize || false == bUseMemPool ||
-            nullptr == m_pMemBlock   || nullptr == m_pFreeMemBlock)
+            (nullptr == m_pFreeMemBlock && (false == m_bGrowable || false == Grow())))
         {
             return malloc(ulSize);
         }
@@ -69,34 +178,36 @@ public:
         // Now FreeList isn`t empty
         struct _Unit *pCurUnit = m_pFreeMemBlock;
         m_pFreeMemBlock = pCurUnit->pNext;  //Get a unit from free linkedlist.
-        if(nullptr != m_pFreeMemBlock)
-        {
-            m_pFreeMemBlock->pPrev = nullptr;
-        }
 
-        pCurUnit->pNext = m_pAllocatedMemBlock;
-        
+#ifdef MEMPOOL_DEBUG
+        struct _Header *pHeader = (struct _Header *)((char *)pCurUnit - sizeof(struct _Header) );
+        pHeader->pPrev = nullptr;
+        pHeader->pNext = m_pAllocatedMemBlock;
+
         if(nullptr != m_pAllocatedMemBlock)
         {
-            m_pAllocatedMemBlock->pPrev = pCurUnit;
+            m_pAllocatedMemBlock->pPrev = pHeader;
         }
-        m_pAllocatedMemBlock = pCurUnit;
+        m_pAllocatedMemBlock = pHeader;
+#endif
 
-        return (void *)((char *)pCurUnit + sizeof(struct _Unit) );
+        return (void *)pCurUnit;
     }
-    
+
     //  To free a memory unit. If the pointer of parameter point to a memory unit,
     //  then insert it to "Free linked list". Otherwise, call system function "free".
     void Free( void* p )
     {
-       if(m_pMemBlock<p && p<(void *)((char *)m_pMemBlock + m_ulBlockSize) )
+       if(Owns(p))
        {
-           struct _Unit *pCurUnit = (struct _Unit *)((char *)p - sizeof(struct _Unit) );
-           
-           struct _Unit* pPrev = pCurUnit->pPrev;
-           struct _Unit* pNext = pCurUnit->pNext;
+           struct _Unit *pCurUnit = (struct _Unit *)p;
+
+#ifdef MEMPOOL_DEBUG
+           struct _Header *pHeader = (struct _Header *)((char *)p - sizeof(struct _Header) );
+           struct _Header* pPrev = pHeader->pPrev;
+           struct _Header* pNext = pHeader->pNext;
            if( pPrev == nullptr){
-               m_pAllocatedMemBlock = pCurUnit->pNext;
+               m_pAllocatedMemBlock = pNext;
            }
            else{
                pPrev->pNext = pNext;
@@ -105,13 +216,10 @@ public:
            {
                pNext->pPrev = pPrev;
            }
+           pHeader->pPrev = pHeader->pNext = nullptr;
+#endif
 
            pCurUnit->pNext = m_pFreeMemBlock;
-           if(nullptr != m_pFreeMemBlock)
-           {
-                m_pFreeMemBlock->pPrev = pCurUnit;
-           }
-
            m_pFreeMemBlock = pCurUnit;
        }
        else
@@ -119,7 +227,7 @@ public:
            free(p);
        }
     }
-    
+
 };
 
 
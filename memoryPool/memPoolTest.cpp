@@ -0,0 +1,220 @@
+/* @file memPoolTest.cpp */
+//  Build with -DMEMPOOL_DEBUG as well to run the same tests with a header in front of every unit.
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "memPool.h"
+#include "threadCachedMemPool.h"
+#include "lockFreeMemPool.h"
+#include "sizeClassAllocator.h"
+
+class mempool_tests{
+public:
+    // Test that freed units are reused and that units don't overlap
+    void testReuse() {
+#ifdef MEMPOOL_DEBUG
+        std::cout << "Testing unit reuse (MEMPOOL_DEBUG) " << std::endl;
+#else
+        std::cout << "Testing unit reuse " << std::endl;
+#endif
+        MemPool pool(4, 32);
+        std::vector<char*> units;
+        for (int i = 0; i < 4; i++) {
+            units.push_back((char*)pool.Alloc(32));
+            std::memset(units.back(), i, 32);
+        }
+        bool intact = true;
+        for (int i = 0; i < 4; i++)
+            intact = intact && units[i][0] == i && units[i][31] == i;
+        std::cout << " ... units don't overlap: " << intact << std::endl;
+        void* freed = units[2];
+        pool.Free(freed);
+        std::cout << "... freed unit reused first: " << (pool.Alloc(32) == freed) << std::endl;
+        // a unit smaller than a pointer still holds the free list link
+        MemPool tiny(4, 1);
+        void* a = tiny.Alloc(1);
+        void* b = tiny.Alloc(1);
+        tiny.Free(a);
+        tiny.Free(b);
+        std::cout << "... tiny units reused: " << (tiny.Alloc(1) == b) << " " << (tiny.Alloc(1) == a) << std::endl;
+        for (int i = 0; i < 4; i++)
+            pool.Free(units[i]);
+    }
+
+    // Test growth by chunks, the 64MB cap and the fixed size fallback to malloc
+    void testGrowth() {
+        std::cout << "Testing growth " << std::endl;
+        MemPool pool(4, 32);
+        std::vector<void*> units;
+        for (int i = 0; i < 12; i++)
+            units.push_back(pool.Alloc(32));
+        std::cout << " ... chunks after 12 units (should be 2): " << pool.ChunkCount() << std::endl;
+        std::set<void*> distinct(units.begin(), units.end());
+        std::cout << "... distinct units: " << (distinct.size() == units.size()) << std::endl;
+        for (void* p : units)
+            pool.Free(p);
+        for (int i = 0; i < 12; i++)
+            pool.Alloc(32);
+        std::cout << "... freed units reused without growing, chunks (should be 2): " << pool.ChunkCount() << std::endl;
+        void* large = pool.Alloc(64);
+        pool.Free(large);
+
+        // chunks of 1, 2, 4, 8 units of 5MB, then clamped to the 12 units fitting in 64MB
+        const unsigned long ulBigUnit = 5ul << 20;
+        MemPool big(1, ulBigUnit);
+        for (int i = 0; i < 28; i++)
+            big.Alloc(ulBigUnit);
+        std::cout << "... chunks of 5MB units (should be 6): " << big.ChunkCount() << std::endl;
+
+        MemPool fixed(2, 32, false);
+        void* p1 = fixed.Alloc(32);
+        void* p2 = fixed.Alloc(32);
+        void* p3 = fixed.Alloc(32);
+        std::cout << "... fixed pool served by malloc, chunks (should be 1): " << fixed.ChunkCount() << std::endl;
+        fixed.Free(p3);
+        fixed.Free(p2);
+        fixed.Free(p1);
+        std::cout << "... unit reused after the malloc one is freed: " << (fixed.Alloc(32) == p1) << std::endl;
+    }
+
+    // Test units allocated by one thread and freed by another
+    void testThreadCached() {
+        std::cout << "Testing thread cached pool " << std::endl;
+        ThreadCachedMemPool pool(64, 48);
+        const int kUnits = 10000;
+        std::vector<void*> handoff;
+        std::mutex handoffMutex;
+        std::atomic<bool> done(false);
+        std::thread producer([&] () {
+            for (int i = 0; i < kUnits; i++) {
+                int* p = (int*)pool.Alloc(48);
+                *p = i;
+                std::lock_guard<std::mutex> g(handoffMutex);
+                handoff.push_back(p);
+            }
+            done = true;
+        });
+        int freed = 0;
+        bool intact = true;
+        while (!done || freed < kUnits) {
+            std::vector<void*> batch;
+            {
+                std::lock_guard<std::mutex> g(handoffMutex);
+                batch.swap(handoff);
+            }
+            for (void* p : batch) {
+                intact = intact && *(int*)p == freed;
+                pool.Free(p, 48);
+                freed++;
+            }
+        }
+        producer.join();
+        std::cout << " ... freed by the consumer: " << freed << " intact: " << intact << std::endl;
+        pool.Free(nullptr, 48);
+        void* p = pool.Alloc(48);
+        std::cout << "... nullptr free ignored: " << (nullptr != p) << std::endl;
+        pool.Free(p, 48);
+        void* large = pool.Alloc(4096);
+        pool.Free(large, 4096);
+    }
+
+    // Test concurrent allocations and cross-thread frees without a mutex
+    void testLockFree() {
+        std::cout << "Testing lock-free pool " << std::endl;
+        LockFreeMemPool pool(16, 24);
+        const int kThreads = 4;
+        const int kIterations = 20000;
+        std::atomic<void*> slots[kThreads];
+        for (auto& s : slots)
+            s = nullptr;
+        std::vector<std::unique_ptr<std::thread>> workers;
+        for (int t = 0; t < kThreads; t++) {
+            workers.push_back(std::unique_ptr<std::thread>(new std::thread([&pool, &slots, t] () {
+                for (int i = 0; i < kIterations; i++) {
+                    int* p = (int*)pool.Alloc(24);
+                    *p = t;
+                    // the unit is freed by whichever thread takes it out of the slot
+                    void* old = slots[(t + i) % kThreads].exchange(p);
+                    if (old)
+                        pool.Free(old);
+                }
+            })));
+        }
+        for (const auto& w : workers) {
+            w->join();
+        }
+        for (auto& s : slots)
+            if (s.load())
+                pool.Free(s.load());
+        std::set<void*> distinct;
+        for (int i = 0; i < 1000; i++)
+            distinct.insert(pool.Alloc(24));
+        std::cout << " ... distinct units after cross-thread frees (should be 1000): " << distinct.size()
+                  << " chunks: " << pool.ChunkCount() << std::endl;
+        for (void* p : distinct)
+            pool.Free(p);
+    }
+
+    // Test the size classes and the mapped large allocations
+    void testSizeClasses() {
+        std::cout << "Testing size classes " << std::endl;
+        typedef SizeClassAllocator<> Allocator;
+        const unsigned long sizes[] = { 0, 1, 16, 17, 128, 129, 160, 161, 2048, 2049, 4095, 4096 };
+        std::cout << " ... classes:";
+        for (unsigned long s : sizes)
+            std::cout << " " << s << "->" << Allocator::ClassSize(Allocator::ClassOf(s));
+        std::cout << std::endl;
+        bool tight = true;
+        for (unsigned long s = 0; s <= Allocator::kMaxClassSize; s++) {
+            unsigned c = Allocator::ClassOf(s);
+            tight = tight && Allocator::ClassSize(c) >= s && (c == 0 || Allocator::ClassSize(c - 1) < s);
+        }
+        std::cout << "... every size in its smallest class: " << tight
+                  << " last class (should be 4096): " << Allocator::ClassSize(Allocator::kClassCount - 1) << std::endl;
+
+        Allocator allocator;
+        std::vector<std::pair<char*, unsigned long>> blocks;
+        const unsigned long large[] = { 24, 200, 4096, 4097, 1ul << 20, 3ul << 20 };
+        for (unsigned long s : large) {
+            char* p = (char*)allocator.Alloc(s);
+            std::memset(p, 1, s);
+            blocks.push_back(std::make_pair(p, s));
+        }
+        for (auto& b : blocks)
+            allocator.Free(b.first, b.second);
+        std::cout << "... small and mapped large blocks written and freed: " << blocks.size() << std::endl;
+
+        SizeClassAllocator<LockFreeMemPool> shared;
+        std::vector<std::unique_ptr<std::thread>> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.push_back(std::unique_ptr<std::thread>(new std::thread([&shared, t] () {
+                for (unsigned long i = 0; i < 5000; i++) {
+                    unsigned long s = (i * 37 + t) % 6000;
+                    void* p = shared.Alloc(s);
+                    std::memset(p, t, s);
+                    shared.Free(p, s);
+                }
+            })));
+        }
+        for (const auto& w : workers) {
+            w->join();
+        }
+        std::cout << "... shared allocator used by 4 threads" << std::endl;
+    }
+};
+
+int main(int argc, char** argv) {
+   mempool_tests tst;
+   tst.testReuse();
+   tst.testGrowth();
+   tst.testThreadCached();
+   tst.testLockFree();
+   tst.testSizeClasses();
+   return 0;
+}
@@ -0,0 +1,145 @@
+//  sizeClassAllocator.h
+//  Cpp-Fundamentals
+
+#ifndef SizeClassAllocator_h
+#define SizeClassAllocator_h
+
+#include <cstdlib>
+#include <memory>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define SIZECLASSALLOCATOR_MMAP 1
+#endif
+
+#include "memPool.h"
+
+// Allocator for objects of many sizes built from one pool per size class, the classes spaced
+// like jemalloc's small classes: every 16 bytes up to 128, then four classes per doubling up to
+// 4096 (160, 192, 224, 256, 320, ...), so that no more than 20% of a unit is wasted past 128
+// bytes. The class of a size is read from a table built at compile time, one entry per 16
+// bytes. Larger requests are mapped with mmap (malloc where mmap is unavailable).
+// Free takes the size passed to Alloc (like a sized delete), which selects the pool or munmap
+// without an ownership lookup.
+// Pool is MemPool or any pool with its constructor, Alloc(ulSize) and Free(p), e.g.
+// LockFreeMemPool to share the allocator between threads.
+// Requires C++14.
+template <class Pool = MemPool>
+class SizeClassAllocator
+{
+public:
+    static const unsigned long kMaxClassSize = 4096;
+    static const unsigned kClassCount = 28;
+
+private:
+    static const unsigned long kQuantum = 16;
+
+    struct _ClassTable //Class of every multiple of kQuantum up to kMaxClassSize.
+    {
+        unsigned char aClass[kMaxClassSize / kQuantum + 1];
+
+        constexpr _ClassTable():
+                aClass()
+        {
+            unsigned uClass = 0;
+            for(unsigned long i=0; i<=kMaxClassSize / kQuantum; i++)
+            {
+                while(ClassSize(uClass) < i * kQuantum)
+                {
+                    uClass++;
+                }
+                aClass[i] = (unsigned char)uClass;
+            }
+        }
+    };
+
+    std::unique_ptr<Pool> m_apPools[kClassCount]; //The pool of every class.
+
+    // Dissallow copying.
+    SizeClassAllocator(const SizeClassAllocator&) = delete;
+    SizeClassAllocator& operator=(const SizeClassAllocator&) = delete;
+
+    static unsigned long PageRound(unsigned long ulSize)
+    {
+#ifdef SIZECLASSALLOCATOR_MMAP
+        static const unsigned long ulPage = (unsigned long)sysconf(_SC_PAGESIZE);
+        return (ulSize + ulPage - 1) / ulPage * ulPage;
+#else
+        return ulSize;
+#endif
+    }
+
+    static void* LargeAlloc(unsigned long ulSize)
+    {
+#ifdef SIZECLASSALLOCATOR_MMAP
+        void* p = mmap(nullptr, PageRound(ulSize), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return MAP_FAILED == p ? nullptr : p;
+#else
+        return malloc(ulSize);
+#endif
+    }
+
+    static void LargeFree(void* p, unsigned long ulSize)
+    {
+#ifdef SIZECLASSALLOCATOR_MMAP
+        munmap(p, PageRound(ulSize));
+#else
+        (void)ulSize;
+        free(p);
+#endif
+    }
+
+public:
+    // Unit size of class uClass.
+    static constexpr unsigned long ClassSize(unsigned uClass)
+    {
+        return uClass < 8 ? (uClass + 1) * kQuantum
+                          : (128ul << (uClass - 8) / 4) / 4 * (4 + 1 + (uClass - 8) % 4);
+    }
+
+    // Class of ulSize, which must not exceed kMaxClassSize.
+    static unsigned ClassOf(unsigned long ulSize)
+    {
+        static constexpr _ClassTable table;
+        return table.aClass[(ulSize + kQuantum - 1) / kQuantum];
+    }
+
+    // Every pool starts with ulUnitNum units, 0 lets a pool allocate its first chunk on its
+    // first Alloc so that unused classes cost nothing.
+    explicit SizeClassAllocator(unsigned long ulUnitNum = 0)
+    {
+        for(unsigned i=0; i<kClassCount; i++)
+        {
+            m_apPools[i].reset(new Pool(ulUnitNum, ClassSize(i)));
+        }
+    }
+
+    void* Alloc(unsigned long ulSize)
+    {
+        if(ulSize > kMaxClassSize)
+        {
+            return LargeAlloc(ulSize);
+        }
+        unsigned uClass = ClassOf(ulSize);
+        return m_apPools[uClass]->Alloc(ClassSize(uClass));
+    }
+
+    // ulSize must be the size passed to Alloc.
+    void Free(void* p, unsigned long ulSize)
+    {
+        if(nullptr == p)
+        {
+            return;
+        }
+        if(ulSize > kMaxClassSize)
+        {
+            LargeFree(p, ulSize);
+            return;
+        }
+        m_apPools[ClassOf(ulSize)]->Free(p);
+    }
+
+};
+
+#endif /* SizeClassAllocator_h */
@@ -0,0 +1,269 @@
+//  threadCachedMemPool.h
+//  Cpp-Fundamentals
+
+#ifndef ThreadCachedMemPool_h
+#define ThreadCachedMemPool_h
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "memPool.h"
+#include "indexStack.h"
+
+// Thread-safe front end of a MemPool for many threads allocating and freeing units at a high
+// rate (the magazine layer of tcmalloc / Bonwick's vmem). Every thread keeps two magazines,
+// small LIFO arrays of free units, and serves Alloc and Free from them without any
+// synchronization. A thread whose magazines run empty or full exchanges a whole magazine with
+// a shared depot of full and empty magazines, two lock-free IndexStack, so the shared state is
+// touched once per kMagazineSize operations. Only when the depot has no full magazine left are
+// units carved from the MemPool, under a mutex.
+// Free takes the size passed to Alloc (like a sized delete): requests larger than the unit size
+// are served by malloc and told apart by their size instead of an ownership lookup.
+// The cache of a thread is handed to the next thread started after it exits; up to kMaxThreads
+// threads get a cache at the same time, the others go to the MemPool under the mutex.
+class ThreadCachedMemPool
+{
+public:
+    static const unsigned long kMagazineSize = 64;
+    static const unsigned kMaxThreads = 256;
+
+private:
+    struct _Magazine //A LIFO of free units.
+    {
+        unsigned long ulCount;
+        void* apUnits[kMagazineSize];
+    };
+
+    struct _ThreadCache //The magazines of a thread, pLoaded serves first.
+    {
+        struct _Magazine aMagazines[2];
+        struct _Magazine* pLoaded;
+        struct _Magazine* pPrevious;
+    };
+
+    unsigned long m_ulUnitSize; //Memory unit size.
+
+    std::unique_ptr<struct _Magazine[]>              m_pDepot; //The magazines of the depot.
+    std::unique_ptr<std::atomic<std::uint32_t>[]>   m_pDepotNext; //Links of the depot stacks.
+    IndexStack<> m_FullMagazines;
+    IndexStack<> m_EmptyMagazines;
+
+    std::atomic<struct _ThreadCache*> m_apCaches[kMaxThreads]; //Cache of every thread index.
+
+    std::mutex   m_Mutex; //Guards m_Pool.
+    MemPool      m_Pool;
+
+    // Dissallow copying.
+    ThreadCachedMemPool(const ThreadCachedMemPool&) = delete;
+    ThreadCachedMemPool& operator=(const ThreadCachedMemPool&) = delete;
+
+    // Thread indices are process wide, allocated to threads on their first use of any
+    // ThreadCachedMemPool and recycled when they exit.
+    struct _Registry
+    {
+        std::mutex mutex;
+        std::vector<unsigned> vFree;
+        unsigned uNext;
+    };
+
+    static struct _Registry& Registry()
+    {
+        static struct _Registry registry = { {}, {}, 0 };
+        return registry;
+    }
+
+    struct _ThreadIndex
+    {
+        unsigned uIndex;
+        _ThreadIndex()
+        {
+            struct _Registry& registry = Registry();
+            std::lock_guard<std::mutex> g(registry.mutex);
+            if(registry.vFree.empty())
+            {
+                uIndex = registry.uNext++;
+            }
+            else
+            {
+                uIndex = registry.vFree.back();
+                registry.vFree.pop_back();
+            }
+        }
+        ~_ThreadIndex()
+        {
+            struct _Registry& registry = Registry();
+            std::lock_guard<std::mutex> g(registry.mutex);
+            registry.vFree.push_back(uIndex);
+        }
+    };
+
+    static unsigned ThreadIndex()
+    {
+        static thread_local struct _ThreadIndex index;
+        return index.uIndex;
+    }
+
+    // The cache of the calling thread, nullptr past kMaxThreads threads.
+    struct _ThreadCache* Cache()
+    {
+        unsigned uIndex = ThreadIndex();
+        if(uIndex >= kMaxThreads)
+        {
+            return nullptr;
+        }
+        struct _ThreadCache* pCache = m_apCaches[uIndex].load(std::memory_order_relaxed);
+        if(nullptr == pCache)
+        {
+            pCache = new struct _ThreadCache;
+            pCache->aMagazines[0].ulCount = pCache->aMagazines[1].ulCount = 0;
+            pCache->pLoaded = &pCache->aMagazines[0];
+            pCache->pPrevious = &pCache->aMagazines[1];
+            m_apCaches[uIndex].store(pCache, std::memory_order_relaxed);
+        }
+        return pCache;
+    }
+
+    static void Swap(struct _ThreadCache* pCache)
+    {
+        struct _Magazine* pMagazine = pCache->pLoaded;
+        pCache->pLoaded = pCache->pPrevious;
+        pCache->pPrevious = pMagazine;
+    }
+
+    // Fills the empty loaded magazine from the depot or else from the MemPool.
+    void Refill(struct _Magazine* pMagazine)
+    {
+        std::uint32_t uIndex;
+        if(m_FullMagazines.Pop(uIndex))
+        {
+            std::memcpy(pMagazine, &m_pDepot[uIndex], sizeof(struct _Magazine));
+            m_EmptyMagazines.Push(uIndex);
+            return;
+        }
+        std::lock_guard<std::mutex> g(m_Mutex);
+        for(unsigned long i=0; i<kMagazineSize; i++)
+        {
+            pMagazine->apUnits[i] = m_Pool.Alloc(m_ulUnitSize);
+        }
+        pMagazine->ulCount = kMagazineSize;
+    }
+
+    // Empties the full magazine into the depot or else back into the MemPool.
+    void Drain(struct _Magazine* pMagazine)
+    {
+        std::uint32_t uIndex;
+        if(m_EmptyMagazines.Pop(uIndex))
+        {
+            std::memcpy(&m_pDepot[uIndex], pMagazine, sizeof(struct _Magazine));
+            m_FullMagazines.Push(uIndex);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> g(m_Mutex);
+            for(unsigned long i=0; i<pMagazine->ulCount; i++)
+            {
+                m_Pool.Free(pMagazine->apUnits[i]);
+            }
+        }
+        pMagazine->ulCount = 0;
+    }
+
+public:
+    // ulUnitNum and ulUnitSize as in MemPool, ulDepotMagazines is the number of full
+    // magazines the depot holds at most.
+    ThreadCachedMemPool(unsigned long ulUnitNum,
+                        unsigned long ulUnitSize,
+                        unsigned long ulDepotMagazines = 256):
+            m_ulUnitSize(ulUnitSize),
+            m_pDepot(new struct _Magazine[ulDepotMagazines]),
+            m_pDepotNext(new std::atomic<std::uint32_t>[ulDepotMagazines]),
+            m_FullMagazines(m_pDepotNext.get()),
+            m_EmptyMagazines(m_pDepotNext.get()),
+            m_Pool(ulUnitNum, ulUnitSize)
+    {
+        for(unsigned i=0; i<kMaxThreads; i++)
+        {
+            m_apCaches[i].store(nullptr, std::memory_order_relaxed);
+        }
+        for(unsigned long i=ulDepotMagazines; i-- > 0; )
+        {
+            m_EmptyMagazines.Push((std::uint32_t)i);
+        }
+    }
+
+    // The units are released with the MemPool, whichever thread cache or magazine holds them.
+    ~ThreadCachedMemPool()
+    {
+        for(unsigned i=0; i<kMaxThreads; i++)
+        {
+            delete m_apCaches[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void* Alloc(unsigned long ulSize)
+    {
+        if(ulSize > m_ulUnitSize)
+        {
+            return malloc(ulSize);
+        }
+        struct _ThreadCache* pCache = Cache();
+        if(nullptr == pCache)
+        {
+            std::lock_guard<std::mutex> g(m_Mutex);
+            return m_Pool.Alloc(ulSize);
+        }
+        if(0 == pCache->pLoaded->ulCount)
+        {
+            if(0 != pCache->pPrevious->ulCount)
+            {
+                Swap(pCache);
+            }
+            else
+            {
+                Refill(pCache->pLoaded);
+            }
+        }
+        return pCache->pLoaded->apUnits[--pCache->pLoaded->ulCount];
+    }
+
+    // ulSize must be the size passed to Alloc.
+    void Free(void* p, unsigned long ulSize)
+    {
+        if(nullptr == p)
+        {
+            return;
+        }
+        if(ulSize > m_ulUnitSize)
+        {
+            free(p);
+            return;
+        }
+        struct _ThreadCache* pCache = Cache();
+        if(nullptr == pCache)
+        {
+            std::lock_guard<std::mutex> g(m_Mutex);
+            m_Pool.Free(p);
+            return;
+        }
+        if(kMagazineSize == pCache->pLoaded->ulCount)
+        {
+            if(kMagazineSize != pCache->pPrevious->ulCount)
+            {
+                Swap(pCache);
+            }
+            else
+            {
+                Drain(pCache->pPrevious);
+                Swap(pCache);
+            }
+        }
+        pCache->pLoaded->apUnits[pCache->pLoaded->ulCount++] = p;
+    }
+};
+
+#endif /* ThreadCachedMemPool_h */